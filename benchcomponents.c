@@ -1,7 +1,18 @@
 #include "headers.h"
+#include "indexes/rbtree.h"
+#include "indexes/rax.h"
+#include "indexes/art.h"
+#include "indexes/btree.h"
+#include "indexes/hashtable.h"
 
+static int nb_workers = 1;
 int get_nb_workers(void) {
-   return 1;
+   return nb_workers;
+}
+
+size_t get_item_size(char *item) {
+   struct item_metadata *meta = (struct item_metadata *)item;
+   return sizeof(*meta) + meta->key_size + meta->value_size;
 }
 
 #define NB_PAGECACHE_ACCESSES 10000000LU
@@ -16,7 +27,8 @@ void bench_pagecache(void) {
       struct lru *lru;
       for(size_t i = 0; i < PAGE_CACHE_SIZE/PAGE_SIZE; i++) {
          uint64_t hash = i;
-         get_page(p, hash, &page, &lru);
+         get_page(p, hash, ACCESS_NORMAL, &page, &lru);
+         lru->contains_data = 1; // pretend the page has been read, otherwise it cannot be evicted
       }
    } stop_timer("Filling the page cache: %lu ops, %lu ops/s\n", PAGE_CACHE_SIZE/PAGE_SIZE, PAGE_CACHE_SIZE/PAGE_SIZE*1000000LU/elapsed);
 
@@ -25,7 +37,8 @@ void bench_pagecache(void) {
       struct lru *lru;
       for(size_t i = 0; i < NB_PAGECACHE_ACCESSES; i++) {
          uint64_t hash = xorshf96() % (PAGE_CACHE_SIZE/PAGE_SIZE);
-         get_page(p, hash, &page, &lru);
+         get_page(p, hash, ACCESS_NORMAL, &page, &lru);
+         lru->contains_data = 1; // pretend the page has been read, otherwise it cannot be evicted
       }
    } stop_timer("Accessing existing pages %lu ops, %lu ops/s\n", NB_PAGECACHE_ACCESSES, NB_PAGECACHE_ACCESSES*1000000LU/elapsed);
 
@@ -34,13 +47,429 @@ void bench_pagecache(void) {
       struct lru *lru;
       for(size_t i = 0; i < NB_PAGECACHE_ACCESSES; i++) {
          uint64_t hash = xorshf96() + PAGE_CACHE_SIZE/PAGE_SIZE;
-         get_page(p, hash, &page, &lru);
+         get_page(p, hash, ACCESS_NORMAL, &page, &lru);
+         lru->contains_data = 1; // pretend the page has been read, otherwise it cannot be evicted
       }
    } stop_timer("Accessing non cached pages %lu ops, %lu ops/s\n", NB_PAGECACHE_ACCESSES, NB_PAGECACHE_ACCESSES*1000000LU/elapsed);
+
+   // Hit ratio of the eviction policy (PAGECACHE_EVICTION)
+   init_zipf_generator(0, 10*PAGE_CACHE_SIZE/PAGE_SIZE - 1);
+   size_t nb_hits = p->nb_hits;
+   start_timer {
+      void *page;
+      struct lru *lru;
+      for(size_t i = 0; i < NB_PAGECACHE_ACCESSES; i++) {
+         uint64_t hash = zipf_next();
+         get_page(p, hash, ACCESS_NORMAL, &page, &lru);
+         lru->contains_data = 1; // pretend the page has been read, otherwise it cannot be evicted
+      }
+   } stop_timer("Zipfian accesses to 10x more pages than the page cache %lu ops, %lu ops/s, %lu%% hits\n", NB_PAGECACHE_ACCESSES, NB_PAGECACHE_ACCESSES*1000000LU/elapsed, (p->nb_hits - nb_hits)*100/NB_PAGECACHE_ACCESSES);
+
+   // Production workload 1, its 500M keys are mapped in order to 4x more pages than the page cache
+   nb_hits = p->nb_hits;
+   start_timer {
+      void *page;
+      struct lru *lru;
+      for(size_t i = 0; i < NB_PAGECACHE_ACCESSES; i++) {
+         uint64_t hash = production_random1() * (4*PAGE_CACHE_SIZE/PAGE_SIZE) / 500000000LU;
+         get_page(p, hash, ACCESS_NORMAL, &page, &lru);
+         lru->contains_data = 1; // pretend the page has been read, otherwise it cannot be evicted
+      }
+   } stop_timer("Production 1 accesses to 4x more pages than the page cache %lu ops, %lu ops/s, %lu%% hits\n", NB_PAGECACHE_ACCESSES, NB_PAGECACHE_ACCESSES*1000000LU/elapsed, (p->nb_hits - nb_hits)*100/NB_PAGECACHE_ACCESSES);
+}
+
+/*
+ * Page cache governor: 2 workers, the first one accesses 1.5x more pages than its fair share, the second one only 0.25x.
+ * Without PAGECACHE_GOVERNOR both keep half of the page cache; with it the first one should end up with the frames the second one doesn't need.
+ */
+#define GOVERNOR_BENCH_PERIOD 100000LU // accesses between two calls to the governor
+void bench_pagecache_governor(void) {
+   declare_timer;
+   struct pagecache *caches[2];
+   size_t nb_accessed[2] = { MAX_PAGE_CACHE/2*3/2, MAX_PAGE_CACHE/2/4 };
+   nb_workers = 2;
+   for(size_t w = 0; w < 2; w++) {
+      caches[w] = calloc(1, sizeof(*caches[w]));
+      page_cache_init(caches[w]);
+   }
+
+   size_t nb_hits = 0;
+   start_timer {
+      void *page;
+      struct lru *lru;
+      for(size_t i = 0; i < NB_PAGECACHE_ACCESSES; i++) {
+         struct pagecache *p = caches[i % 2];
+         if(PAGECACHE_GOVERNOR && i % GOVERNOR_BENCH_PERIOD == 0)
+            page_cache_rebalance(caches, 2);
+         if(PAGECACHE_GOVERNOR)
+            page_cache_release_frames(p);
+         nb_hits += get_page(p, xorshf96() % nb_accessed[i % 2], ACCESS_NORMAL, &page, &lru);
+         lru->contains_data = 1; // pretend the page has been read, otherwise it cannot be evicted
+      }
+   } stop_timer("Governor: 2 workers accessing 1.5x and 0.25x their share of the page cache %lu ops, %lu%% hits, final sizes %lu and %lu pages\n", NB_PAGECACHE_ACCESSES, nb_hits*100/NB_PAGECACHE_ACCESSES, caches[0]->nb_pages, caches[1]->nb_pages);
+
+   // Give the frames back for the next benchmarks
+   for(size_t w = 0; w < 2; w++) {
+      caches[w]->target_pages = 0;
+      if(PAGECACHE_GOVERNOR)
+         page_cache_release_frames(caches[w]);
+   }
+   nb_workers = 1;
+}
+
+/*
+ * Page cache resizing: fill the page cache, shrink it to RESIZE_MIN_SHARE % and grow it back, with the memory used by the process (RSS).
+ */
+static size_t get_rss(void) {
+   size_t size, resident = 0;
+   FILE *f = fopen("/proc/self/statm", "r");
+   if(f) {
+      if(fscanf(f, "%lu %lu", &size, &resident) != 2)
+         resident = 0;
+      fclose(f);
+   }
+   return resident * sysconf(_SC_PAGESIZE);
+}
+
+void bench_pagecache_resize(void) {
+   declare_timer;
+   void *page;
+   struct lru *lru;
+   struct pagecache *p = calloc(1, sizeof(*p));
+   page_cache_init(p);
+   size_t nb_pages = p->target_pages;
+   for(size_t i = 0; i < nb_pages; i++) {
+      get_page(p, i, ACCESS_NORMAL, &page, &lru);
+      memset(page, 1, PAGE_SIZE);
+      lru->contains_data = 1;
+   }
+   size_t rss_full = get_rss();
+
+   size_t nb_resizes = 0;
+   start_timer {
+      while(p->target_pages > MAX_PAGE_CACHE * RESIZE_MIN_SHARE / 100 && nb_resizes < 100) {
+         page_cache_resize(&p, 1, 0);
+         page_cache_release_frames(p);
+         nb_resizes++;
+      }
+   } stop_timer("Resize: shrinking the page cache from %lu to %lu pages in %lu steps, RSS %luMB -> %luMB\n", nb_pages, p->nb_pages, nb_resizes, rss_full/1024/1024, get_rss()/1024/1024);
+
+   start_timer {
+      while(p->target_pages < nb_pages)
+         page_cache_resize(&p, 1, 1);
+      for(size_t i = 0; i < nb_pages; i++) {
+         if(!get_page(p, nb_pages + i, ACCESS_NORMAL, &page, &lru))
+            memset(page, 1, PAGE_SIZE);
+         lru->contains_data = 1;
+      }
+   } stop_timer("Resize: growing the page cache back to %lu pages, RSS %luMB\n", p->nb_pages, get_rss()/1024/1024);
+   p->target_pages = 0;
+   page_cache_release_frames(p);
+}
+
+/*
+ * Scans: zipfian point reads of 4x more pages than fit in the page cache, and every SCAN_BENCH_PERIOD reads a scan of SCAN_BENCH_LENGTH
+ * pages that are never read again. Hit rate of the point reads when the scans are hinted (ACCESS_SCAN) or not.
+ */
+#define SCAN_BENCH_PERIOD 10
+#define SCAN_BENCH_LENGTH 50
+void bench_scan_resistance(void) {
+   declare_timer;
+   nb_workers = 4;
+   for(int hinted = 0; hinted < 2; hinted++) {
+      struct pagecache *p = calloc(1, sizeof(*p));
+      page_cache_init(p);
+      size_t nb_pages = 4 * p->target_pages;
+      init_zipf_generator(0, nb_pages - 1);
+      size_t nb_point_reads = 0, nb_point_hits = 0;
+      start_timer {
+         void *page;
+         struct lru *lru;
+         for(size_t i = 0; i < NB_PAGECACHE_ACCESSES; i++) {
+            if(i % SCAN_BENCH_PERIOD == 0) {
+               uint64_t first = (1LU << 40) + xorshf96() % (100 * nb_pages); // another file, much bigger
+               for(size_t j = 0; j < SCAN_BENCH_LENGTH; j++) {
+                  get_page(p, first + j, hinted?ACCESS_SCAN:ACCESS_NORMAL, &page, &lru);
+                  lru->contains_data = 1;
+               }
+            } else {
+               nb_point_hits += get_page(p, zipf_next() * 2654435761LU % nb_pages, ACCESS_NORMAL, &page, &lru);
+               nb_point_reads++;
+               lru->contains_data = 1; // pretend the page has been read, otherwise it cannot be evicted
+            }
+         }
+      } stop_timer("Scans: zipfian point reads of %lu pages with a %lu pages cache and scans of %d pages %s, %lu%% point read hits\n", nb_pages, p->target_pages, SCAN_BENCH_LENGTH, hinted?"hinted ACCESS_SCAN":"not hinted", nb_point_hits*100/nb_point_reads);
+      p->target_pages = 0;
+      if(PAGECACHE_GOVERNOR)
+         page_cache_release_frames(p);
+   }
+   nb_workers = 1;
+}
+
+/*
+ * Object cache: zipfian reads of 400B items, 10x more than fit in the budget (a quarter of the page cache), whose slots are spread over the slab
+ * like the items of KVell (by the hash of their key). The budget is used by a page cache (10 items per page) or by an object cache.
+ */
+#define OBJCACHE_BENCH_ITEM_SIZE 400
+void bench_objcache(void) {
+   declare_timer;
+   size_t budget = PAGE_CACHE_SIZE / 4;
+   size_t nb_items = 10 * budget / OBJCACHE_BENCH_ITEM_SIZE;
+   size_t items_per_page = PAGE_SIZE / OBJCACHE_BENCH_ITEM_SIZE;
+   char item[OBJCACHE_BENCH_ITEM_SIZE];
+   struct item_metadata *meta = (struct item_metadata *)item;
+   meta->key_size = sizeof(uint64_t);
+   meta->value_size = OBJCACHE_BENCH_ITEM_SIZE - sizeof(*meta) - sizeof(uint64_t);
+   struct slab s = { .fds = { 3 } };
+   init_zipf_generator(0, nb_items - 1);
+
+   nb_workers = 4;
+   struct pagecache *p = calloc(1, sizeof(*p));
+   page_cache_init(p);
+   size_t nb_hits = 0;
+   start_timer {
+      void *page;
+      struct lru *lru;
+      for(size_t i = 0; i < NB_PAGECACHE_ACCESSES; i++) {
+         size_t idx = zipf_next() * 2654435761LU % nb_items; // prime multiplier, a permutation of the items
+         nb_hits += get_page(p, idx / items_per_page, ACCESS_NORMAL, &page, &lru);
+         lru->contains_data = 1; // pretend the page has been read, otherwise it cannot be evicted
+      }
+   } stop_timer("Object cache: %luMB of page cache, zipfian reads of %lu %dB items %lu ops, %lu ops/s, %lu%% hits\n", budget/1024/1024, nb_items, OBJCACHE_BENCH_ITEM_SIZE, NB_PAGECACHE_ACCESSES, NB_PAGECACHE_ACCESSES*1000000LU/elapsed, nb_hits*100/NB_PAGECACHE_ACCESSES);
+   p->target_pages = 0;
+   if(PAGECACHE_GOVERNOR)
+      page_cache_release_frames(p);
+   nb_workers = 1;
+
+   struct objcache *c = objcache_init(budget);
+   start_timer {
+      for(size_t i = 0; i < NB_PAGECACHE_ACCESSES; i++) {
+         size_t idx = zipf_next() * 2654435761LU % nb_items;
+         if(!objcache_lookup(c, &s, idx))
+            objcache_admit(c, &s, idx, item);
+      }
+   } stop_timer("Object cache: %luMB of object cache, zipfian reads of %lu %dB items %lu ops, %lu ops/s, %lu%% hits\n", budget/1024/1024, nb_items, OBJCACHE_BENCH_ITEM_SIZE, NB_PAGECACHE_ACCESSES, NB_PAGECACHE_ACCESSES*1000000LU/elapsed, c->nb_hits*100/NB_PAGECACHE_ACCESSES);
+}
+
+/*
+ * Compressed tier: zipfian reads of 8x more pages than fit in the budget (an eighth of the page cache), with the whole budget in the page cache
+ * or half of it in the page cache and half in the compressed tier. The pages are pages of the 1365B slab filled with YCSB items as the YCSB
+ * workload creates them (see create_unique_item); the content of the pages that come back from the tier is checked.
+ */
+#define ZCACHE_BENCH_ITEM_SIZE 1024
+#define ZCACHE_BENCH_SLAB_SIZE 1365
+static void fill_zcache_bench_page(char *page, size_t page_num) {
+   memset(page, 0, PAGE_SIZE);
+   for(size_t i = 0; i < PAGE_SIZE / ZCACHE_BENCH_SLAB_SIZE; i++) {
+      struct item_metadata *meta = (struct item_metadata *)&page[i * ZCACHE_BENCH_SLAB_SIZE];
+      meta->rdt = page_num;
+      meta->key_size = sizeof(uint64_t);
+      meta->value_size = ZCACHE_BENCH_ITEM_SIZE - 64 - sizeof(*meta);
+      *(uint64_t*)&meta[1] = page_num * 3 + i;
+      *(uint64_t*)((char*)&meta[1] + sizeof(uint64_t)) = page_num * 3 + i;
+   }
+}
+
+void bench_zcache(void) {
+   declare_timer;
+   size_t budget = PAGE_CACHE_SIZE / 8;
+   size_t nb_bench_pages = 8 * budget / PAGE_SIZE;
+   char expected[PAGE_SIZE];
+   init_zipf_generator(0, nb_bench_pages - 1);
+
+   for(int tier = 0; tier < 2; tier++) {
+      nb_workers = tier?16:8;
+      struct pagecache *p = calloc(1, sizeof(*p));
+      page_cache_init(p);
+      if(tier && !p->zcache)
+         p->zcache = zcache_init(budget / 2);
+
+      size_t nb_hits = 0;
+      start_timer {
+         void *page;
+         struct lru *lru;
+         for(size_t i = 0; i < NB_PAGECACHE_ACCESSES; i++) {
+            size_t page_num = zipf_next() * 2654435761LU % nb_bench_pages;
+            if(get_page(p, page_num, ACCESS_NORMAL, &page, &lru)) {
+               nb_hits++;
+               continue;
+            }
+            fill_zcache_bench_page(page, page_num); // "read" the page
+            lru->contains_data = 1;
+            lru->valid_sectors = ALL_SECTORS;
+         }
+      } stop_timer("Compressed tier: %luMB of page cache%s, zipfian reads of %lu pages %lu ops, %lu ops/s, %lu%% hits\n", (tier?budget/2:budget)/1024/1024, tier?" + same size of compressed tier":"", nb_bench_pages, NB_PAGECACHE_ACCESSES, NB_PAGECACHE_ACCESSES*1000000LU/elapsed, nb_hits*100/NB_PAGECACHE_ACCESSES);
+
+      if(tier) {
+         struct zcache *z = p->zcache;
+         printf("#\tCompressed tier: %lu pages stored (%lu%% of their size on average), %lu incompressible, %lu hits\n", z->nb_stored, z->nb_stored?z->stored_bytes*100/z->nb_stored/PAGE_SIZE:0, z->nb_incompressible, z->nb_hits);
+         // Check the pages that come back from the tier
+         size_t nb_checked = 0;
+         for(size_t page_num = 0; page_num < nb_bench_pages && nb_checked < 10000; page_num++) {
+            void *page;
+            struct lru *lru;
+            size_t zhits = z->nb_hits;
+            int cached = get_page(p, page_num, ACCESS_NORMAL, &page, &lru);
+            if(z->nb_hits == zhits) {
+               if(!cached) {
+                  fill_zcache_bench_page(page, page_num);
+                  lru->contains_data = 1;
+                  lru->valid_sectors = ALL_SECTORS;
+               }
+               continue;
+            }
+            fill_zcache_bench_page(expected, page_num);
+            if(memcmp(page, expected, PAGE_SIZE))
+               die("Page %lu changed in the compressed tier\n", page_num);
+            nb_checked++;
+         }
+         printf("#\tCompressed tier: checked the content of %lu pages\n", nb_checked);
+      }
+      p->target_pages = 0;
+      if(PAGECACHE_GOVERNOR)
+         page_cache_release_frames(p);
+   }
+   nb_workers = 1;
+}
+
+/*
+ * Page cache indexes: the PAGECACHE_INDEX backends on the operations of get_page, with page cache keys ((fd << 40) + page_num)
+ * - lookups of cached pages (hits);
+ * - misses: lookup of an absent page, delete of the oldest page, insert of the new page (eviction).
+ */
+#define NB_INDEX_PAGES (1024*1024LU) // pages of a 4GB page cache
+struct pagecache_index {
+   const char *name;
+   void *(*create)(size_t max_entries);
+   int (*lookup)(void *t, uint64_t hash);
+   void (*insert)(void *t, uint64_t hash, struct index_entry *e);
+   void (*delete)(void *t, uint64_t hash);
+};
+
+static void *rbtree_bench_create(size_t n) { return rbtree_create(); }
+static int rbtree_bench_lookup(void *t, uint64_t h) { return rbtree_lookup(t, (void*)h, pointer_cmp) != NULL; }
+static void rbtree_bench_insert(void *t, uint64_t h, struct index_entry *e) { rbtree_insert(t, (void*)h, e, pointer_cmp); }
+static void rbtree_bench_delete(void *t, uint64_t h) { rbtree_delete(t, (void*)h, pointer_cmp); }
+
+static void *rax_bench_create(size_t n) { return raxNew(); }
+static int rax_bench_lookup(void *t, uint64_t h) { return raxFind(t, (unsigned char*)&h, sizeof(h)) != raxNotFound; }
+static void rax_bench_insert(void *t, uint64_t h, struct index_entry *e) { raxInsert(t, (unsigned char*)&h, sizeof(h), e, NULL); }
+static void rax_bench_delete(void *t, uint64_t h) { raxRemove(t, (unsigned char*)&h, sizeof(h), NULL); }
+
+static void *art_bench_create(size_t n) { art_tree *t = malloc(sizeof(*t)); art_tree_init(t); return t; }
+static int art_bench_lookup(void *t, uint64_t h) { return art_search(t, (unsigned char*)&h, sizeof(h)) != NULL; }
+static void art_bench_insert(void *t, uint64_t h, struct index_entry *e) { art_insert(t, (unsigned char*)&h, sizeof(h), e); }
+static void art_bench_delete(void *t, uint64_t h) { art_delete(t, (unsigned char*)&h, sizeof(h)); }
+
+static void *btree_bench_create(size_t n) { return btree_create(); }
+static int btree_bench_lookup(void *t, uint64_t h) { struct index_entry e; return btree_find(t, (unsigned char*)&h, sizeof(h), &e); }
+static void btree_bench_insert(void *t, uint64_t h, struct index_entry *e) { btree_insert(t, (unsigned char*)&h, sizeof(h), e); }
+static void btree_bench_delete(void *t, uint64_t h) { btree_delete(t, (unsigned char*)&h, sizeof(h)); }
+
+static void *hashtable_bench_create(size_t n) { return hashtable_create(n); }
+static int hashtable_bench_lookup(void *t, uint64_t h) { return hashtable_lookup(t, h) != NULL; }
+static void hashtable_bench_insert(void *t, uint64_t h, struct index_entry *e) { hashtable_insert(t, h, e); }
+static void hashtable_bench_delete(void *t, uint64_t h) { hashtable_delete(t, h); }
+
+static struct pagecache_index pagecache_indexes[] = {
+   { "RBTREE", rbtree_bench_create, rbtree_bench_lookup, rbtree_bench_insert, rbtree_bench_delete },
+   { "RAX", rax_bench_create, rax_bench_lookup, rax_bench_insert, rax_bench_delete },
+   { "ART", art_bench_create, art_bench_lookup, art_bench_insert, art_bench_delete },
+   { "BTREE", btree_bench_create, btree_bench_lookup, btree_bench_insert, btree_bench_delete },
+   { "HASHTABLE", hashtable_bench_create, hashtable_bench_lookup, hashtable_bench_insert, hashtable_bench_delete },
+};
+
+static uint64_t page_hash(size_t i) { // pages spread over 16 files, like the slabs of a worker
+   return ((uint64_t)(i % 16 + 3) << 40) + i / 16;
+}
+
+void bench_pagecache_indexes(void) {
+   declare_timer;
+   static struct index_entry entry; // the trees that store pointers all point to the same entry, only the index is measured
+   for(size_t b = 0; b < sizeof(pagecache_indexes)/sizeof(*pagecache_indexes); b++) {
+      struct pagecache_index *idx = &pagecache_indexes[b];
+      void *t = idx->create(NB_INDEX_PAGES);
+
+      start_timer {
+         for(size_t i = 0; i < NB_INDEX_PAGES; i++)
+            idx->insert(t, page_hash(i), &entry);
+      } stop_timer("%s - Filling: %lu inserts, %lu ops/s\n", idx->name, NB_INDEX_PAGES, NB_INDEX_PAGES*1000000LU/elapsed);
+
+      size_t found = 0;
+      start_timer {
+         for(size_t i = 0; i < NB_PAGECACHE_ACCESSES; i++)
+            found += idx->lookup(t, page_hash(xorshf96() % NB_INDEX_PAGES));
+      } stop_timer("%s - Hits: %lu lookups, %lu ops/s\n", idx->name, NB_PAGECACHE_ACCESSES, NB_PAGECACHE_ACCESSES*1000000LU/elapsed);
+      if(found != NB_PAGECACHE_ACCESSES)
+         die("%s: %lu pages found instead of %lu\n", idx->name, found, NB_PAGECACHE_ACCESSES);
+
+      found = 0;
+      start_timer {
+         for(size_t i = NB_INDEX_PAGES; i < NB_INDEX_PAGES + NB_PAGECACHE_ACCESSES; i++) {
+            found += idx->lookup(t, page_hash(i));
+            idx->delete(t, page_hash(i - NB_INDEX_PAGES));
+            idx->insert(t, page_hash(i), &entry);
+         }
+      } stop_timer("%s - Misses: %lu lookups + evictions, %lu ops/s\n", idx->name, NB_PAGECACHE_ACCESSES, NB_PAGECACHE_ACCESSES*1000000LU/elapsed);
+      if(found)
+         die("%s: %lu evicted pages found\n", idx->name, found);
+   }
+}
+
+/*
+ * Emulated device: CPU cost of going through the IO path and accuracy of the latency model
+ */
+#define NB_EMULATED_IOS 1000000LU
+#define EMULATED_QUEUE_DEPTH 64
+void bench_emulated_device(void) {
+   declare_timer;
+   aio_context_t ctx;
+   struct iocb cb[EMULATED_QUEUE_DEPTH], *cbs[EMULATED_QUEUE_DEPTH];
+   struct io_event events[EMULATED_QUEUE_DEPTH];
+   char *buffers = aligned_alloc(PAGE_SIZE, PAGE_SIZE * EMULATED_QUEUE_DEPTH);
+   size_t nb_pages = 1024*1024;
+
+   int fd = emulated_open("bench");
+   if(fd == -1 || ftruncate(fd, nb_pages * PAGE_SIZE))
+      die("Cannot create emulated file\n");
+   emulated_io_setup(EMULATED_QUEUE_DEPTH, &ctx);
+
+   uint64_t total_latency = 0;
+   start_timer {
+      for(size_t i = 0; i < NB_EMULATED_IOS; i += EMULATED_QUEUE_DEPTH) {
+         uint64_t submit, complete;
+         memset(cb, 0, sizeof(cb));
+         for(size_t j = 0; j < EMULATED_QUEUE_DEPTH; j++) {
+            cb[j].aio_fildes = fd;
+            cb[j].aio_lio_opcode = IOCB_CMD_PREAD;
+            cb[j].aio_buf = (uint64_t)&buffers[PAGE_SIZE*j];
+            cb[j].aio_offset = (xorshf96() % nb_pages) * PAGE_SIZE;
+            cb[j].aio_nbytes = PAGE_SIZE;
+            cbs[j] = &cb[j];
+         }
+         rdtscll(submit);
+         emulated_io_submit(ctx, EMULATED_QUEUE_DEPTH, cbs);
+         emulated_io_getevents(ctx, EMULATED_QUEUE_DEPTH, EMULATED_QUEUE_DEPTH, events);
+         rdtscll(complete);
+         total_latency += complete - submit;
+      }
+   } stop_timer("Emulated device: %lu reads at queue depth %d, %lu ops/s, %lu us per batch\n", NB_EMULATED_IOS, EMULATED_QUEUE_DEPTH, NB_EMULATED_IOS*1000000LU/elapsed, cycles_to_us(total_latency)/(NB_EMULATED_IOS/EMULATED_QUEUE_DEPTH));
+
+   emulated_io_destroy(ctx);
+   close(fd);
+   free(buffers);
 }
 
 int main(int argc, char **argv) {
+   bench_pagecache_indexes();
+   bench_pagecache_governor();
+   if(PAGECACHE_RESIZE)
+      bench_pagecache_resize();
+   bench_scan_resistance();
+   bench_objcache();
+   bench_zcache();
    bench_pagecache();
+   bench_emulated_device();
    return 0;
 }
 
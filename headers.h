@@ -15,6 +15,7 @@
 #include <sys/mman.h>
 #include <assert.h>
 #include <string.h>
+#include <errno.h>
 #include <sys/time.h>
 #include <pthread.h>
 #include <signal.h>
@@ -27,10 +28,16 @@
 #include "items.h"
 
 #include "pagecache.h"
+#include "zcache.h"
+#include "objcache.h"
 #include "in-memory-index-generic.h"
 #include "ioengine.h"
+#include "ioengine-emulated.h"
+#include "iotrace.h"
 #include "slab.h"
 #include "slabworker.h"
+#include "warmup.h"
+#include "mempressure.h"
 
 #include "stats.h"
 #include "freelist.h"
@@ -9,6 +9,8 @@
 #include "in-memory-index-art.h"
 #elif MEMORY_INDEX == BTREE
 #include "in-memory-index-btree.h"
+#else
+#error "MEMORY_INDEX must support scans, use RBTREE, RAX, ART or BTREE"
 #endif
 
 #endif
@@ -0,0 +1,157 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "hashtable.h"
+
+/*
+ * Linear probing hash table with a 1 byte tag per slot (7 bits of the hash, the top bit set for used slots, 0 for empty slots).
+ * A probe compares the tags of GROUP_WIDTH slots at once (one SSE2 compare) and only looks at the keys of the slots whose tag matches.
+ * The tag array is followed by a copy of its first GROUP_WIDTH - 1 tags, so a group can be loaded at any position without wrapping.
+ *
+ * Deleted slots are not marked with tombstones: the page cache keeps replacing pages, tombstones would pile up in a table that never resizes.
+ * Instead the entries that follow a deleted entry in its probe run are shifted back (Knuth's algorithm R), so a probe always stops at the
+ * first empty slot. The table is sized for a load factor of at most 3/4, so runs are short.
+ */
+#define GROUP_WIDTH 16
+#define TAG_EMPTY 0
+
+struct slot {
+   uint64_t key;
+   struct index_entry value;
+};
+
+struct hashtable {
+   uint8_t *tags;        // capacity + GROUP_WIDTH - 1 tags
+   struct slot *slots;   // capacity slots
+   size_t mask;          // capacity - 1, capacity is a power of 2
+   size_t nb_entries;
+   size_t max_entries;
+};
+
+static inline uint64_t hash_key(uint64_t key) { // murmur3 finalizer, keys are (fd << 40) + page_num so the low bits alone are a bad hash
+   key ^= key >> 33;
+   key *= 0xff51afd7ed558ccdLU;
+   key ^= key >> 33;
+   key *= 0xc4ceb9fe1a85ec53LU;
+   key ^= key >> 33;
+   return key;
+}
+
+static inline uint8_t tag_of(uint64_t h) {
+   return (h >> 57) | 0x80;
+}
+
+/* Bitmap of the slots of the group starting at pos whose tag is tag */
+static inline uint32_t match_group(hashtable_t *t, size_t pos, uint8_t tag) {
+#ifdef __SSE2__
+   __m128i group = _mm_loadu_si128((__m128i*)&t->tags[pos]);
+   return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(tag)));
+#else
+   uint32_t res = 0;
+   for(size_t i = 0; i < GROUP_WIDTH; i++)
+      if(t->tags[pos + i] == tag)
+         res |= 1U << i;
+   return res;
+#endif
+}
+
+static inline void set_tag(hashtable_t *t, size_t idx, uint8_t tag) {
+   t->tags[idx] = tag;
+   if(idx < GROUP_WIDTH - 1)
+      t->tags[t->mask + 1 + idx] = tag;
+}
+
+hashtable_t *hashtable_create(size_t max_entries) {
+   hashtable_t *t = calloc(1, sizeof(*t));
+   size_t capacity = GROUP_WIDTH;
+   while(capacity * 3 / 4 < max_entries)
+      capacity *= 2;
+   t->mask = capacity - 1;
+   t->max_entries = max_entries;
+   t->tags = calloc(capacity + GROUP_WIDTH - 1, sizeof(*t->tags));
+   t->slots = calloc(capacity, sizeof(*t->slots));
+   assert(t->tags && t->slots);
+   return t;
+}
+
+void hashtable_free(hashtable_t *t) {
+   free(t->tags);
+   free(t->slots);
+   free(t);
+}
+
+/*
+ * Scan the probe run of key. @return the slot of key if it is in the table, otherwise -1 and *free_slot is the first empty slot of the run.
+ */
+static inline ssize_t find_slot(hashtable_t *t, uint64_t key, uint64_t h, size_t *free_slot) {
+   uint8_t tag = tag_of(h);
+   size_t pos = h & t->mask;
+   while(1) {
+      uint32_t matches = match_group(t, pos, tag);
+      uint32_t empty = match_group(t, pos, TAG_EMPTY);
+      if(empty)
+         matches &= (empty & -empty) - 1; // entries after the first empty slot belong to other runs
+      while(matches) {
+         size_t idx = (pos + __builtin_ctz(matches)) & t->mask;
+         if(t->slots[idx].key == key)
+            return idx;
+         matches &= matches - 1;
+      }
+      if(empty) {
+         if(free_slot)
+            *free_slot = (pos + __builtin_ctz(empty)) & t->mask;
+         return -1;
+      }
+      pos = (pos + GROUP_WIDTH) & t->mask;
+   }
+}
+
+struct index_entry *hashtable_lookup(hashtable_t *t, uint64_t key) {
+   ssize_t idx = find_slot(t, key, hash_key(key), NULL);
+   return (idx < 0)?NULL:&t->slots[idx].value;
+}
+
+void hashtable_insert(hashtable_t *t, uint64_t key, struct index_entry *e) {
+   uint64_t h = hash_key(key);
+   size_t free_slot = 0;
+   ssize_t idx = find_slot(t, key, h, &free_slot);
+   if(idx >= 0) {
+      t->slots[idx].value = *e;
+      return;
+   }
+   if(t->nb_entries == t->max_entries) {
+      fprintf(stderr, "Hashtable full (%lu entries)\n", t->max_entries);
+      abort();
+   }
+   t->slots[free_slot].key = key;
+   t->slots[free_slot].value = *e;
+   set_tag(t, free_slot, tag_of(h));
+   t->nb_entries++;
+}
+
+void hashtable_delete(hashtable_t *t, uint64_t key) {
+   ssize_t idx = find_slot(t, key, hash_key(key), NULL);
+   if(idx < 0)
+      return;
+
+   // Shift back the entries of the run that can live in the hole, i.e., the entries whose home slot is not in (hole, j]
+   size_t hole = idx, j = idx;
+   while(1) {
+      j = (j + 1) & t->mask;
+      if(t->tags[j] == TAG_EMPTY)
+         break;
+      size_t home = hash_key(t->slots[j].key) & t->mask;
+      int stays = (hole <= j)?(hole < home && home <= j):(hole < home || home <= j);
+      if(stays)
+         continue;
+      t->slots[hole] = t->slots[j];
+      set_tag(t, hole, t->tags[j]);
+      hole = j;
+   }
+   set_tag(t, hole, TAG_EMPTY);
+   t->nb_entries--;
+}
@@ -0,0 +1,22 @@
+#ifndef HASHTABLE_H
+#define HASHTABLE_H 1
+
+#include <stdint.h>
+#include <unistd.h>
+#include "memory-item.h"
+
+/*
+ * Fixed capacity open addressing hash table, for point lookups only (no scans, see PAGECACHE_INDEX).
+ * All the memory is allocated by hashtable_create: inserts and deletes never allocate, and the table never resizes.
+ * Inserting more than max_entries keys is a bug (the table dies).
+ */
+struct hashtable;
+typedef struct hashtable hashtable_t;
+
+hashtable_t *hashtable_create(size_t max_entries);
+struct index_entry *hashtable_lookup(hashtable_t *t, uint64_t key); // the entry is only valid until the next insert or delete
+void hashtable_insert(hashtable_t *t, uint64_t key, struct index_entry *e); // insert or replace
+void hashtable_delete(hashtable_t *t, uint64_t key);
+void hashtable_free(hashtable_t *t);
+
+#endif
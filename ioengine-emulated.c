@@ -0,0 +1,193 @@
+#include "headers.h"
+#include "random.h"
+#include <math.h>
+#include <errno.h>
+#include <sys/uio.h>
+
+/*
+ * Emulated NVMe device.
+ *
+ * Same interface as Linux AIO (io_setup / io_submit / io_getevents) but there is no drive:
+ * - files are memfds (emulated_open), so they live in RAM and no disk is needed;
+ * - the data is copied when the request is submitted, but the completion only becomes visible once the modeled service time has elapsed.
+ * With this engine, the whole KV path (workers, page cache, indexes) runs as usual and can be profiled on any machine.
+ *
+ * Service time of a request of B bytes submitted at time T, N requests being in flight in the device:
+ *    transfer: requests are transferred one after the other at EMULATED_BANDWIDTH
+ *              start = max(T, end of the transfer of the previous request), end = start + B / bandwidth
+ *    latency:  EMULATED_FIXED            EMULATED_LATENCY
+ *              EMULATED_LOGNORMAL        EMULATED_LATENCY * exp(EMULATED_LATENCY_SIGMA * normal())
+ *              EMULATED_QUEUE_DEPENDENT  EMULATED_LATENCY * (1 + (N - EMULATED_QUEUE_KNEE) / EMULATED_QUEUE_KNEE) when N > EMULATED_QUEUE_KNEE
+ *    completion = end + latency
+ *
+ * Each io context is a device. When several contexts share a drive (workers of the same disk), call emulated_io_share_device
+ * so that each of them only gets its share of the bandwidth.
+ */
+
+struct emulated_io {
+   uint64_t completion;       // cycles
+   struct iocb *iocb;
+   int64_t res;
+};
+
+struct emulated_device {
+   size_t max_pending;
+   struct emulated_io *pending; // min heap on completion time
+   size_t nb_pending;
+   uint64_t transfer_end;       // cycles
+   uint64_t bandwidth;          // bytes/s, 0 = unlimited
+   uint64_t cycles_per_sec;     // transfer times are computed in cycles, a 512B IO takes less than 1us at a share of the bandwidth
+};
+
+int emulated_open(const char *path) {
+   const char *name = strrchr(path, '/');
+   return memfd_create(name?(name + 1):path, 0);
+}
+
+/*
+ * Min heap of pending requests
+ */
+static void heap_push(struct emulated_device *d, struct emulated_io *io) {
+   size_t i = d->nb_pending++;
+   while(i > 0) {
+      size_t parent = (i - 1) / 2;
+      if(d->pending[parent].completion <= io->completion)
+         break;
+      d->pending[i] = d->pending[parent];
+      i = parent;
+   }
+   d->pending[i] = *io;
+}
+
+static void heap_pop(struct emulated_device *d, struct emulated_io *io) {
+   *io = d->pending[0];
+   struct emulated_io last = d->pending[--d->nb_pending];
+   size_t i = 0;
+   while(1) {
+      size_t child = 2*i + 1;
+      if(child >= d->nb_pending)
+         break;
+      if(child + 1 < d->nb_pending && d->pending[child + 1].completion < d->pending[child].completion)
+         child++;
+      if(last.completion <= d->pending[child].completion)
+         break;
+      d->pending[i] = d->pending[child];
+      i = child;
+   }
+   d->pending[i] = last;
+}
+
+/*
+ * Latency model
+ */
+static double uniform01(void) {
+   return ((double)(locxorshf96() % (1LU << 52)) + 1.) / (double)(1LU << 52);
+}
+
+static uint64_t get_latency(struct emulated_device *d) {
+   double latency = EMULATED_LATENCY;
+   if(EMULATED_LATENCY_MODEL == EMULATED_LOGNORMAL) {
+      double normal = sqrt(-2. * log(uniform01())) * cos(2. * M_PI * uniform01()); // Box-Muller
+      latency *= exp(EMULATED_LATENCY_SIGMA * normal);
+   } else if(EMULATED_LATENCY_MODEL == EMULATED_QUEUE_DEPENDENT) {
+      if(d->nb_pending > EMULATED_QUEUE_KNEE)
+         latency *= 1. + (double)(d->nb_pending - EMULATED_QUEUE_KNEE) / EMULATED_QUEUE_KNEE;
+   }
+   return us_to_cycles(latency);
+}
+
+static int64_t do_emulated_io(struct iocb *cb) {
+   int64_t ret;
+   switch(cb->aio_lio_opcode) {
+      case IOCB_CMD_PREAD:
+         ret = pread(cb->aio_fildes, (void*)cb->aio_buf, cb->aio_nbytes, cb->aio_offset);
+         break;
+      case IOCB_CMD_PWRITE:
+         ret = pwrite(cb->aio_fildes, (void*)cb->aio_buf, cb->aio_nbytes, cb->aio_offset);
+         break;
+      case IOCB_CMD_PREADV:
+         ret = preadv(cb->aio_fildes, (struct iovec*)cb->aio_buf, cb->aio_nbytes, cb->aio_offset);
+         break;
+      case IOCB_CMD_PWRITEV:
+         ret = pwritev(cb->aio_fildes, (struct iovec*)cb->aio_buf, cb->aio_nbytes, cb->aio_offset);
+         break;
+      case IOCB_CMD_FDSYNC:
+         ret = fdatasync(cb->aio_fildes);
+         break;
+      default:
+         return -EINVAL;
+   }
+   if(ret >= 0 && (cb->aio_rw_flags & RWF_DSYNC))
+      fdatasync(cb->aio_fildes);
+   return (ret < 0)?-errno:ret;
+}
+
+/*
+ * AIO interface
+ */
+int emulated_io_setup(unsigned nr, aio_context_t *ctxp) {
+   struct emulated_device *d = calloc(1, sizeof(*d));
+   d->max_pending = nr;
+   d->pending = calloc(nr, sizeof(*d->pending));
+   d->bandwidth = EMULATED_BANDWIDTH * 1024LU * 1024LU;
+   d->cycles_per_sec = us_to_cycles(1000000LU);
+   *ctxp = (aio_context_t)d;
+   return 0;
+}
+
+void emulated_io_share_device(aio_context_t ctx, size_t nb_contexts) {
+   struct emulated_device *d = (void*)ctx;
+   d->bandwidth = EMULATED_BANDWIDTH * 1024LU * 1024LU / nb_contexts;
+}
+
+int emulated_io_submit(aio_context_t ctx, long nr, struct iocb **iocbpp) {
+   struct emulated_device *d = (void*)ctx;
+   uint64_t now;
+   rdtscll(now);
+
+   for(long i = 0; i < nr; i++) {
+      if(d->nb_pending == d->max_pending)
+         return i?i:-EAGAIN;
+
+      struct emulated_io io = { .iocb = iocbpp[i] };
+      io.res = do_emulated_io(iocbpp[i]);
+
+      uint64_t start = (d->transfer_end > now)?d->transfer_end:now;
+      if(d->bandwidth && io.res > 0)
+         start += io.res * d->cycles_per_sec / d->bandwidth;
+      d->transfer_end = start;
+      io.completion = start + get_latency(d);
+      heap_push(d, &io);
+   }
+   return nr;
+}
+
+/* Like io_getevents, blocks (polls) until at least min_nr requests have completed */
+int emulated_io_getevents(aio_context_t ctx, long min_nr, long max_nr, struct io_event *events) {
+   struct emulated_device *d = (void*)ctx;
+   long nb_events = 0;
+   uint64_t now;
+
+   while(1) {
+      rdtscll(now);
+      while(nb_events < max_nr && d->nb_pending && d->pending[0].completion <= now) {
+         struct emulated_io io;
+         heap_pop(d, &io);
+         events[nb_events].data = io.iocb->aio_data;
+         events[nb_events].obj = (uint64_t)io.iocb;
+         events[nb_events].res = io.res;
+         events[nb_events].res2 = 0;
+         nb_events++;
+      }
+      if(nb_events >= min_nr || !d->nb_pending)
+         return nb_events;
+      NOP10();
+   }
+}
+
+int emulated_io_destroy(aio_context_t ctx) {
+   struct emulated_device *d = (void*)ctx;
+   free(d->pending);
+   free(d);
+   return 0;
+}
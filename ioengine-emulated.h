@@ -0,0 +1,12 @@
+#ifndef IOENGINE_EMULATED_H
+#define IOENGINE_EMULATED_H 1
+
+int emulated_open(const char *path);
+
+int emulated_io_setup(unsigned nr, aio_context_t *ctxp);
+void emulated_io_share_device(aio_context_t ctx, size_t nb_contexts);
+int emulated_io_submit(aio_context_t ctx, long nr, struct iocb **iocbpp);
+int emulated_io_getevents(aio_context_t ctx, long min_nr, long max_nr, struct io_event *events);
+int emulated_io_destroy(aio_context_t ctx);
+
+#endif
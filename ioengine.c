@@ -1,4 +1,8 @@
 #include "headers.h"
+#if IO_ENGINE == IO_URING
+#include <linux/io_uring.h>
+#include <errno.h>
+#endif
 
 /*
  * Asynchronous IO engine.
@@ -19,6 +23,42 @@
  * It means the page must be in memory, it is not possible to write a non cached page.
  * This could be easilly changed if need be.
  *
+ * Slabs of small items can read and write only some sectors of a page (read_sectors_async / write_sectors_async, see SECTOR_IO).
+ * The page cache then knows which sectors of the page are valid. A write only writes the span of the sectors modified since the
+ * previous write. Writing a page still requires the full page to be valid: that way the span never contains sectors that haven't been read.
+ *
+ * IOs are pipelined: completions are reaped as soon as they happen, so the engine can have reads and writes in flight
+ * while new requests are being processed. Two writes of the same page are never in flight at the same time, otherwise the
+ * drive could reorder them and persist the old content: a write is held back in the queue until the previous write of the page completes.
+ *
+ * Before being submitted, IOs are sorted and requests to contiguous pages of the same file are merged in a single vectored IO (COALESCE_IOS).
+ * When the vectored IO completes, the callbacks of all the pages are called as if the pages had been read / written independently.
+ *
+ * IOs are split in two lanes (IO_LANES). Reads on which a user request is waiting are always submitted first. Writes and scan reads are
+ * background IOs: only BACKGROUND_IO_SHARE % of the queue depth can be used by them, the others stay queued until a background IO completes.
+ * That way a burst of writes doesn't fill the device queue in front of reads.
+ *
+ * With ADAPTIVE_QUEUE_DEPTH, the queue depth of the worker is not fixed. Every ADAPTIVE_QUEUE_DEPTH_WINDOW ms, the worker compares the
+ * throughput and latency of its IOs with the previous window and moves the queue depth by a small step (hill climbing):
+ * - throughput improved: keep going in the same direction;
+ * - throughput degraded: go back;
+ * - throughput is flat but latency grew: decrease the queue depth, the extra IOs only add latency (we are past the knee);
+ * - throughput and latency are flat: keep probing in the same direction.
+ * Windows during which the queue depth was never reached say nothing about the drive and are ignored.
+ *
+ * With WRITE_BACK, write_page_async doesn't send anything to disk: the page is marked as modified and the callback is called directly.
+ * The flusher (worker_ioengine_flush) then writes modified pages in batches, when they get too old (durability bound), when too many
+ * pages are modified, or when modified pages are next in line for eviction and would otherwise prevent it.
+ *
+ * DURABILITY decides when a write is acknowledged. By default the callback is called when the drive acknowledges the write, which
+ * might only be in its volatile cache. With DURABILITY_FUA writes are sent with RWF_DSYNC. With DURABILITY_GROUP_FLUSH completed writes
+ * wait in a group; the group is flushed with one fdatasync per file (sent as an IO, like the writes) when it is big enough, old enough,
+ * or when the drive is idle, and the callbacks of the group are called when the fdatasyncs complete.
+ * A write is only counted in lru_entry->write_gen once it is durable, so callbacks linked to a queued write wait for its flush too.
+ *
+ * With IO_TRACE, every request sent to the kernel is logged (see iotrace.h) when it completes. Records are buffered and the
+ * worker appends them to its trace file every IO_TRACE_BUFFER IOs.
+ *
  * ASSUMPTIONS:
  *   The page cache is big enough to hold as many pages as concurrent buffered IOs.
  */
@@ -39,6 +79,7 @@ void *safe_pread(int fd, off_t offset) {
 /*
  * Async API definition
  */
+#if IO_ENGINE == LINUX_AIO
 static int io_setup(unsigned nr, aio_context_t *ctxp) {
 	return syscall(__NR_io_setup, nr, ctxp);
 }
@@ -52,86 +93,580 @@ static int io_getevents(aio_context_t ctx, long min_nr, long max_nr,
 	return syscall(__NR_io_getevents, ctx, min_nr, max_nr, events, timeout);
 }
 
+/*
+ * The aio_context_t is the address of the completion ring, mapped in user space by the kernel.
+ * Completions can be consumed from the ring without a syscall (head is ours, tail is the kernel's).
+ */
+#define AIO_RING_MAGIC 0xa10a10a1
+struct aio_ring {
+   unsigned id;
+   unsigned nr;      // number of io_events
+   unsigned head;
+   unsigned tail;
+   unsigned magic;
+   unsigned compat_features;
+   unsigned incompat_features;
+   unsigned header_length;
+   struct io_event io_events[0];
+};
+
+#elif IO_ENGINE == IO_URING
+static int io_uring_setup(unsigned entries, struct io_uring_params *p) {
+   return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+   return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args) {
+   return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/*
+ * io_uring rings. The kernel and the worker share the submission and completion rings.
+ * Slab files are registered as fixed files and the page cache of the worker as fixed buffers, so the kernel doesn't have to
+ * look them up / pin them on every IO. With IO_URING_SQPOLL a kernel thread consumes the submission ring and submitting is syscall free.
+ */
+#define IO_URING_FIXED_BUFFER_SIZE (1LU<<30) // The kernel refuses to register buffers larger than 1GB, so the page cache is registered 1GB by 1GB
+struct uring {
+   int fd;
+   unsigned *sq_head, *sq_tail, *sq_mask, *sq_entries, *sq_flags, *sq_array;
+   unsigned *cq_head, *cq_tail, *cq_mask;
+   struct io_uring_sqe *sqes;
+   struct io_uring_cqe *cqes;
+   int *fixed_files;          // fd -> index in the registered file table, -1 if the fd is not registered
+   size_t nb_fixed_files;     // size of the fixed_files array
+   char *fixed_buffers;       // start of the registered memory (the page cache), NULL if registration failed
+   size_t fixed_buffers_size;
+};
+#endif
+
 
 /*
  * Definition of the context of an IO worker thread
  */
 struct linked_callbacks {
    struct slab_callback *callback;
+   uint64_t write_gen; // 0 for a read, otherwise the lru_entry->write_gen after which the page content of the callback is on disk
+   uint64_t sectors;   // read: the sectors that must be valid
    struct linked_callbacks *next;
 };
+struct coalesced_io {
+   struct iocb iocb;                            // Vectored request sent to the kernel, must stay first
+   struct iovec iov[MAX_COALESCED_PAGES];
+   struct iocb *pages[MAX_COALESCED_PAGES];     // Original requests, one per page
+   size_t nb_pages;
+};
 struct io_context {
    aio_context_t ctx __attribute__((aligned(64)));
-   volatile size_t sent_io;
-   volatile size_t processed_io;
    size_t max_pending_io;
-   size_t ios_sent_to_disk;
-   struct iocb *iocb;
-   struct iocb **iocbs;
-   struct io_event *events;
-   struct linked_callbacks *linked_callbacks;
+   struct iocb *iocb;               // All IO requests
+   struct iocb **free_iocbs;        // Stack of unused IO requests
+   size_t nb_free_iocbs;
+   struct iocb **iocbs;             // IO requests enqueued but not yet submitted to the kernel
+   size_t nb_queued_ios;
+   size_t ios_in_flight;            // IO requests submitted to the kernel and not yet completed (in pages)
+   struct iocb **background_iocbs;  // Temporary array, background IOs that have been queued
+   char *is_background;             // is_background[iocb idx] = iocb is a background IO in flight
+   size_t background_in_flight;
+   uint64_t *submit_time;           // submit_time[iocb idx] = when the IO was sent to the kernel (ADAPTIVE_QUEUE_DEPTH, IO_TRACE)
+   size_t queue_depth;              // Current queue depth, see ADAPTIVE_QUEUE_DEPTH
+   struct {
+      uint64_t window_start;
+      uint64_t total_latency;       // in cycles
+      size_t nb_completed;
+      int saturated;                // The queue depth has been reached during the window
+      int direction;                // +1 or -1
+      uint64_t prev_throughput;     // IO/s during the previous window
+      uint64_t prev_latency;        // us
+   } qd;
+   struct coalesced_io *coalesced;  // Merged requests
+   struct coalesced_io **free_coalesced;
+   size_t nb_free_coalesced;
+   struct slab_callback *flush_callbacks; // Write back: callbacks used by the flusher
+   struct slab_callback **free_flush_callbacks;
+   size_t nb_free_flush_callbacks;
+   struct {
+      struct slab_callback **waiting;  // DURABILITY_GROUP_FLUSH: completed writes waiting for the next flush
+      size_t nb_waiting;
+      uint64_t oldest;                 // when the first write of the group completed
+      struct slab_callback **flushing; // Writes covered by the fdatasyncs in flight
+      size_t nb_flushing;
+      size_t nb_syncs;                 // fdatasyncs in flight
+      int *fds;                        // Temporary array, files touched by the group
+      uint64_t delay;                  // GROUP_FLUSH_DELAY in cycles
+   } gf;
+   struct linked_callbacks *linked;  // Pool of waiters (see lru_entry->waiters)
+   struct linked_callbacks **free_linked;
+   size_t nb_free_linked;
+   struct {
+      int fd;
+      struct io_trace_record *records;
+      size_t nb_records;
+   } trace;
+   struct iocb **submitted_iocbs;   // Temporary array passed to the kernel
+   struct io_event *events;         // Completed IOs, not yet processed
+   size_t nb_events;
+#if IO_ENGINE == LINUX_AIO
+   struct aio_ring *aio_ring;       // NULL if the ring cannot be polled
+   uint64_t aio_ring_spin;          // AIO_RING_SPIN in cycles
+#elif IO_ENGINE == IO_URING
+   struct uring ring;
+#endif
 };
 
+#if IO_ENGINE == LINUX_AIO
+static void engine_setup(struct io_context *ctx) {
+   int ret = io_setup(ctx->max_pending_io, &ctx->ctx);
+   if(ret < 0)
+      perr("Cannot create aio setup\n");
+
+   struct aio_ring *ring = (void*)ctx->ctx;
+   if(AIO_RING_POLLING && ring->magic == AIO_RING_MAGIC && ring->incompat_features == 0)
+      ctx->aio_ring = ring;
+   else if(AIO_RING_POLLING)
+      printf("#WARNING! Unknown AIO completion ring format, using io_getevents\n");
+   ctx->aio_ring_spin = us_to_cycles(AIO_RING_SPIN);
+}
+
+static int engine_submit(struct io_context *ctx, long nr, struct iocb **iocbs) {
+   return io_submit(ctx->ctx, nr, iocbs);
+}
+
+/* Consume completions from the ring, no syscall */
+static long aio_ring_reap(struct aio_ring *ring, long max_nr, struct io_event *events) {
+   unsigned head = ring->head;
+   unsigned tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+   long nr = 0;
+   while(head != tail && nr < max_nr) {
+      events[nr++] = ring->io_events[head];
+      head = (head + 1) % ring->nr;
+   }
+   __atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+   return nr;
+}
+
+/* Poll the ring first, then spin on it for a bit, and only sleep in io_getevents when it is really needed */
+static int engine_getevents(struct io_context *ctx, long min_nr, long max_nr, struct io_event *events) {
+   struct aio_ring *ring = ctx->aio_ring;
+   if(!ring)
+      return io_getevents(ctx->ctx, min_nr, max_nr, events, NULL);
+
+   long nr = aio_ring_reap(ring, max_nr, events);
+   if(nr >= min_nr)
+      return nr;
+
+   uint64_t start, now;
+   rdtscll(start);
+   do {
+      NOP10();
+      nr += aio_ring_reap(ring, max_nr - nr, &events[nr]);
+      rdtscll(now);
+   } while(nr < min_nr && now - start < ctx->aio_ring_spin);
+   if(nr >= min_nr)
+      return nr;
+
+   int ret = io_getevents(ctx->ctx, min_nr - nr, max_nr - nr, &events[nr], NULL);
+   if(ret < 0)
+      return ret;
+   return nr + ret;
+}
+
+#elif IO_ENGINE == EMULATED
+static void engine_setup(struct io_context *ctx) {
+   emulated_io_setup(ctx->max_pending_io, &ctx->ctx);
+   emulated_io_share_device(ctx->ctx, (get_nb_workers() + get_nb_disks() - 1) / get_nb_disks()); // workers of a disk share its bandwidth (at most that many workers per disk)
+}
+
+static int engine_submit(struct io_context *ctx, long nr, struct iocb **iocbs) {
+   return emulated_io_submit(ctx->ctx, nr, iocbs);
+}
+
+static int engine_getevents(struct io_context *ctx, long min_nr, long max_nr, struct io_event *events) {
+   return emulated_io_getevents(ctx->ctx, min_nr, max_nr, events);
+}
+
+#elif IO_ENGINE == IO_URING
+static void engine_setup(struct io_context *ctx) {
+   struct uring *r = &ctx->ring;
+   struct io_uring_params params;
+   memset(&params, 0, sizeof(params));
+   if(IO_URING_SQPOLL) {
+      params.flags |= IORING_SETUP_SQPOLL;
+      params.sq_thread_idle = IO_URING_SQPOLL_IDLE;
+   }
+
+   r->fd = io_uring_setup(ctx->max_pending_io, &params);
+   if(r->fd < 0)
+      perr("Cannot create io_uring (SQPOLL %d)\n", IO_URING_SQPOLL);
+
+   size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+   size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+   if((params.features & IORING_FEAT_SINGLE_MMAP) && cq_size > sq_size)
+      sq_size = cq_size;
+
+   char *sq = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+   char *cq = sq;
+   if(!(params.features & IORING_FEAT_SINGLE_MMAP))
+      cq = mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+   r->sqes = mmap(NULL, params.sq_entries * sizeof(*r->sqes), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+   if(sq == MAP_FAILED || cq == MAP_FAILED || r->sqes == MAP_FAILED)
+      perr("Cannot map io_uring rings\n");
+
+   r->sq_head = (void*)(sq + params.sq_off.head);
+   r->sq_tail = (void*)(sq + params.sq_off.tail);
+   r->sq_mask = (void*)(sq + params.sq_off.ring_mask);
+   r->sq_entries = (void*)(sq + params.sq_off.ring_entries);
+   r->sq_flags = (void*)(sq + params.sq_off.flags);
+   r->sq_array = (void*)(sq + params.sq_off.array);
+   r->cq_head = (void*)(cq + params.cq_off.head);
+   r->cq_tail = (void*)(cq + params.cq_off.tail);
+   r->cq_mask = (void*)(cq + params.cq_off.ring_mask);
+   r->cqes = (void*)(cq + params.cq_off.cqes);
+}
+
+static int engine_submit(struct io_context *ctx, long nr, struct iocb **iocbs) {
+   struct uring *r = &ctx->ring;
+   unsigned tail = *r->sq_tail;
+   for(size_t i = 0; i < nr; i++) {
+      struct iocb *cb = iocbs[i];
+      char *buf = (char*)cb->aio_buf;
+      int write = (cb->aio_lio_opcode == IOCB_CMD_PWRITE || cb->aio_lio_opcode == IOCB_CMD_PWRITEV);
+      int sync = (cb->aio_lio_opcode == IOCB_CMD_FDSYNC);
+
+      while(tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE) >= *r->sq_entries) // only happens with SQPOLL, when the kernel thread lags behind
+         NOP10();
+
+      unsigned idx = tail & *r->sq_mask;
+      struct io_uring_sqe *sqe = &r->sqes[idx];
+      memset(sqe, 0, sizeof(*sqe));
+      if(sync) {
+         sqe->opcode = IORING_OP_FSYNC;
+         sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+      } else if(cb->aio_lio_opcode == IOCB_CMD_PREADV || cb->aio_lio_opcode == IOCB_CMD_PWRITEV) { // aio_buf is an array of iovecs
+         sqe->opcode = write?IORING_OP_WRITEV:IORING_OP_READV;
+      } else if(r->fixed_buffers && buf >= r->fixed_buffers && buf < r->fixed_buffers + r->fixed_buffers_size) {
+         sqe->opcode = write?IORING_OP_WRITE_FIXED:IORING_OP_READ_FIXED;
+         sqe->buf_index = (buf - r->fixed_buffers) / IO_URING_FIXED_BUFFER_SIZE;
+      } else {
+         sqe->opcode = write?IORING_OP_WRITE:IORING_OP_READ;
+      }
+      if(cb->aio_fildes < r->nb_fixed_files && r->fixed_files[cb->aio_fildes] >= 0) {
+         sqe->fd = r->fixed_files[cb->aio_fildes];
+         sqe->flags |= IOSQE_FIXED_FILE;
+      } else {
+         sqe->fd = cb->aio_fildes;
+      }
+      sqe->addr = cb->aio_buf;
+      sqe->len = cb->aio_nbytes;
+      sqe->off = cb->aio_offset;
+      if(!sync)
+         sqe->rw_flags = cb->aio_rw_flags;
+      sqe->user_data = (uint64_t)cb;
+      r->sq_array[idx] = idx;
+      tail++;
+   }
+   __atomic_store_n(r->sq_tail, tail, __ATOMIC_RELEASE);
+
+   if(IO_URING_SQPOLL) {
+      if(__atomic_load_n(r->sq_flags, __ATOMIC_ACQUIRE) & IORING_SQ_NEED_WAKEUP)
+         io_uring_enter(r->fd, 0, 0, IORING_ENTER_SQ_WAKEUP);
+      return nr;
+   }
+   return io_uring_enter(r->fd, nr, 0, 0);
+}
+
+/* Same semantic as io_getevents: completions are translated to io_events so that the rest of the engine doesn't care about the backend */
+static int engine_getevents(struct io_context *ctx, long min_nr, long max_nr, struct io_event *events) {
+   struct uring *r = &ctx->ring;
+   long nr = 0;
+   while(nr < max_nr) {
+      unsigned head = *r->cq_head;
+      if(head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) {
+         if(nr >= min_nr)
+            break;
+         if(io_uring_enter(r->fd, 0, min_nr - nr, IORING_ENTER_GETEVENTS) < 0)
+            perr("io_uring_enter failed while waiting for %ld completions\n", min_nr - nr);
+         continue;
+      }
+      struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+      events[nr].data = 0;
+      events[nr].obj = cqe->user_data;
+      events[nr].res = cqe->res;
+      events[nr].res2 = 0;
+      __atomic_store_n(r->cq_head, head + 1, __ATOMIC_RELEASE);
+      nr++;
+   }
+   return nr;
+}
+#endif
+
 /*
- * After completing IOs we need to call all the "linked callbacks", i.e., reads done to a page that was already in the process of being fetched.
+ * "Linked callbacks" are requests to a page that already has an IO in flight: reads of sectors that are already being fetched,
+ * or writes of a page whose write is already queued. They wait in the waiter list of the page and are woken up when an IO of
+ * that page completes, so a completion only looks at the waiters of its own page.
  */
-static void process_linked_callbacks(struct io_context *ctx) {
-   declare_debug_timer;
+static void link_callback(struct io_context *ctx, struct lru *lru_entry, struct slab_callback *callback, uint64_t write_gen, uint64_t sectors) {
+   if(ctx->nb_free_linked == 0)
+      die("Too many linked callbacks (%lu)\n", ctx->max_pending_io);
+   struct linked_callbacks *linked_cb = ctx->free_linked[--ctx->nb_free_linked];
+   linked_cb->callback = callback;
+   linked_cb->write_gen = write_gen;
+   linked_cb->sectors = sectors;
+   linked_cb->next = lru_entry->waiters;
+   lru_entry->waiters = linked_cb;
+}
 
-   size_t nb_linked = 0;
-   start_debug_timer {
-      struct linked_callbacks *linked_cb;
-      linked_cb = ctx->linked_callbacks;
-      ctx->linked_callbacks = NULL; // reset the list
-
-      while(linked_cb) {
-         struct linked_callbacks *next = linked_cb->next;
-         struct slab_callback *callback = linked_cb->callback;
-         if(callback->lru_entry->contains_data) {
-            callback->io_cb(callback);
-            free(linked_cb);
-         } else { // page has not been prefetched yet, it's likely in the list of pages that will be read during the next kernel call
-            linked_cb->next = ctx->linked_callbacks;
-            ctx->linked_callbacks = linked_cb; // re-link our callback
-         }
-         linked_cb = next;
-         nb_linked++;
+static void wake_waiters(struct io_context *ctx, struct lru *lru_entry) {
+   struct linked_callbacks *linked_cb = lru_entry->waiters;
+   lru_entry->waiters = NULL; // callbacks might link new waiters
+   while(linked_cb) {
+      struct linked_callbacks *next = linked_cb->next;
+      struct slab_callback *callback = linked_cb->callback;
+      int done;
+      if(linked_cb->write_gen)
+         done = (lru_entry->write_gen >= linked_cb->write_gen);
+      else
+         done = ((lru_entry->valid_sectors & linked_cb->sectors) == linked_cb->sectors);
+      if(done) {
+         ctx->free_linked[ctx->nb_free_linked++] = linked_cb;
+         callback->io_cb(callback);
+      } else { // waiting for another IO of the page
+         linked_cb->next = lru_entry->waiters;
+         lru_entry->waiters = linked_cb;
       }
-   } stop_debug_timer(10000, "%lu linked callbacks\n", nb_linked);
+      linked_cb = next;
+   }
+}
+
+/*
+ * Get a free IO request and put it in the submission queue
+ */
+static struct iocb *get_iocb(struct io_context *ctx) {
+   if(ctx->nb_free_iocbs == 0)
+      die("%lu ios queued, %lu in flight (> %lu waiting), IO buffer is too full!\n", ctx->nb_queued_ios, ctx->ios_in_flight, ctx->max_pending_io);
+   struct iocb *_iocb = ctx->free_iocbs[--ctx->nb_free_iocbs];
+   memset(_iocb, 0, sizeof(*_iocb));
+   ctx->iocbs[ctx->nb_queued_ios++] = _iocb;
+   return _iocb;
+}
+
+static void put_iocb(struct io_context *ctx, struct iocb *_iocb) {
+   ctx->free_iocbs[ctx->nb_free_iocbs++] = _iocb;
+}
+
+/*
+ * Merge requests to contiguous pages.
+ * Requests are sorted by file and offset, and runs of contiguous pages are replaced by a single vectored request.
+ * @return the new number of requests in ctx->submitted_iocbs
+ */
+static int cmp_iocb(const void *_a, const void *_b) {
+   const struct iocb *a = *(struct iocb **)_a;
+   const struct iocb *b = *(struct iocb **)_b;
+   if(a->aio_fildes != b->aio_fildes)
+      return (a->aio_fildes < b->aio_fildes)?-1:1;
+   if(a->aio_lio_opcode != b->aio_lio_opcode)
+      return (a->aio_lio_opcode < b->aio_lio_opcode)?-1:1;
+   if(a->aio_offset != b->aio_offset)
+      return (a->aio_offset < b->aio_offset)?-1:1;
+   return 0;
+}
+
+static int is_coalesced_io(struct io_context *ctx, struct iocb *_iocb) {
+   return (void*)_iocb >= (void*)ctx->coalesced && (void*)_iocb < (void*)&ctx->coalesced[ctx->max_pending_io];
+}
+
+static size_t coalesce_ios(struct io_context *ctx, size_t nb_ios) {
+   struct iocb **ios = ctx->submitted_iocbs;
+   size_t nb_requests = 0;
+
+   qsort(ios, nb_ios, sizeof(*ios), cmp_iocb);
+   for(size_t i = 0; i < nb_ios; ) {
+      size_t j = i + 1;
+      while(j < nb_ios && j - i < MAX_COALESCED_PAGES
+            && ios[i]->aio_lio_opcode != IOCB_CMD_FDSYNC
+            && ios[j]->aio_fildes == ios[i]->aio_fildes
+            && ios[j]->aio_lio_opcode == ios[i]->aio_lio_opcode
+            && ios[j]->aio_offset == ios[j-1]->aio_offset + ios[j-1]->aio_nbytes)
+         j++;
+
+      if(j - i == 1 || ctx->nb_free_coalesced == 0) { // nothing to merge
+         ios[nb_requests++] = ios[i++];
+         continue;
+      }
+
+      struct coalesced_io *c = ctx->free_coalesced[--ctx->nb_free_coalesced];
+      c->nb_pages = j - i;
+      for(size_t k = 0; k < c->nb_pages; k++) {
+         c->pages[k] = ios[i + k];
+         c->iov[k].iov_base = (void*)ios[i + k]->aio_buf;
+         c->iov[k].iov_len = ios[i + k]->aio_nbytes;
+      }
+      memset(&c->iocb, 0, sizeof(c->iocb));
+      c->iocb.aio_fildes = ios[i]->aio_fildes;
+      c->iocb.aio_lio_opcode = (ios[i]->aio_lio_opcode == IOCB_CMD_PWRITE)?IOCB_CMD_PWRITEV:IOCB_CMD_PREADV;
+      c->iocb.aio_rw_flags = ios[i]->aio_rw_flags;
+      c->iocb.aio_buf = (uint64_t)c->iov;
+      c->iocb.aio_nbytes = c->nb_pages;
+      c->iocb.aio_offset = ios[i]->aio_offset;
+      c->iocb.aio_data = (uint64_t)c;
+      ios[nb_requests++] = &c->iocb;
+      i = j;
+   }
+   return nb_requests;
+}
+
+/*
+ * Background IOs: writes and scan reads. Nobody is waiting on them as urgently as on a point read.
+ */
+static int is_background_io(struct iocb *_iocb) {
+   struct slab_callback *callback = (void*)_iocb->aio_data;
+   if(_iocb->aio_lio_opcode == IOCB_CMD_FDSYNC) // writes are waiting for it, it has no callback
+      return 0;
+   return _iocb->aio_lio_opcode == IOCB_CMD_PWRITE || callback->hint == ACCESS_SCAN;
+}
+
+/*
+ * Prepare an IO for submission.
+ * @return 0 if the IO must stay queued
+ */
+static int prepare_iocb(struct io_context *ctx, struct iocb *_iocb) {
+   struct slab_callback *callback = (void*)_iocb->aio_data;
+   if(_iocb->aio_lio_opcode == IOCB_CMD_FDSYNC)
+      return 1;
+
+   struct lru *lru_entry = callback->lru_entry;
+   if(_iocb->aio_lio_opcode == IOCB_CMD_PWRITE) {
+      if(DURABILITY == DURABILITY_FUA)
+         _iocb->aio_rw_flags = RWF_DSYNC;
+      if(lru_entry->writing) // The previous version of the page is still being written, wait for it before writing the page again
+         return 0;
+      lru_entry->writing = 1;
+
+      // Only write the sectors that have been modified; the iocb points to the beginning of the page until now
+      uint64_t sectors = lru_entry->dirty_sectors?lru_entry->dirty_sectors:ALL_SECTORS;
+      size_t first = __builtin_ctzl(sectors), last = 63 - __builtin_clzl(sectors);
+      _iocb->aio_buf += first * SECTOR_SIZE;
+      _iocb->aio_offset += first * SECTOR_SIZE;
+      _iocb->aio_nbytes = (last - first + 1) * SECTOR_SIZE;
+      lru_entry->dirty_sectors = 0;
+   }
+   lru_entry->dirty = 0;  // reset the dirty flag *before* sending write orders otherwise following writes might be ignored
+                          // race condition if flag is reset after:
+                          //        io_submit
+                          //        flush done to disk
+                          //              |                           write page (no IO order because dirty = 1, see write_page_async "if(lru_entry->dirty)" condition)
+                          //        complete ios
+                          //        (old value written to disk)
+
+   add_time_in_payload(callback, 3);
+   return 1;
+}
+
+static size_t background_budget(struct io_context *ctx) {
+   size_t budget = ctx->queue_depth * BACKGROUND_IO_SHARE / 100;
+   return budget?budget:1;
+}
+
+/*
+ * DURABILITY_GROUP_FLUSH: send one fdatasync per file touched by the waiting writes.
+ * Only one group is flushed at a time; writes that complete meanwhile wait for the next group.
+ */
+static void group_flush(struct io_context *ctx) {
+   if(DURABILITY != DURABILITY_GROUP_FLUSH || !ctx->gf.nb_waiting || ctx->gf.nb_syncs)
+      return;
+
+   uint64_t now;
+   rdtscll(now);
+   int idle = !ctx->ios_in_flight && !ctx->nb_queued_ios; // no other write will join the group, don't make it wait
+   if(!idle && ctx->gf.nb_waiting < GROUP_FLUSH_SIZE && now - ctx->gf.oldest < ctx->gf.delay)
+      return;
+
+   size_t nb_fds = 0;
+   for(size_t i = 0; i < ctx->gf.nb_waiting; i++) {
+      int fd = ctx->gf.waiting[i]->lru_entry->hash >> 40LU; // see get_hash_for_page
+      size_t j = 0;
+      while(j < nb_fds && ctx->gf.fds[j] != fd)
+         j++;
+      if(j == nb_fds)
+         ctx->gf.fds[nb_fds++] = fd;
+   }
+   if(ctx->nb_free_iocbs < nb_fds)
+      return;
+
+   for(size_t i = 0; i < nb_fds; i++) {
+      struct iocb *_iocb = get_iocb(ctx);
+      _iocb->aio_fildes = ctx->gf.fds[i];
+      _iocb->aio_lio_opcode = IOCB_CMD_FDSYNC;
+   }
+   ctx->gf.nb_syncs = nb_fds;
+
+   struct slab_callback **group = ctx->gf.waiting;
+   ctx->gf.waiting = ctx->gf.flushing;
+   ctx->gf.flushing = group;
+   ctx->gf.nb_flushing = ctx->gf.nb_waiting;
+   ctx->gf.nb_waiting = 0;
 }
 
 /*
  * Loop executed by worker threads
  */
 static void worker_do_io(struct io_context *ctx) {
-   size_t pending = ctx->sent_io - ctx->processed_io;
-   if(pending == 0) {
-      ctx->ios_sent_to_disk = 0;
+   group_flush(ctx);
+
+   size_t pending = ctx->nb_queued_ios;
+   size_t nb_submitted = 0, nb_held_back = 0, nb_background = 0;
+   if(pending == 0)
       return;
-   }
-   /*if(pending > QUEUE_DEPTH)
-      pending = QUEUE_DEPTH;*/
 
+   // Foreground lane, everything goes
    for(size_t i = 0; i < pending; i++) {
-      struct slab_callback *callback;
-      ctx->iocbs[i] = &ctx->iocb[(ctx->processed_io + i)%ctx->max_pending_io];
-      callback = (void*)ctx->iocbs[i]->aio_data;
-      callback->lru_entry->dirty = 0;  // reset the dirty flag *before* sending write orders otherwise following writes might be ignored
-                                       // race condition if flag is reset after:
-                                       //        io_submit
-                                       //        flush done to disk
-                                       //              |                           write page (no IO order because dirty = 1, see write_page_async "if(lru_entry->dirty)" condition)
-                                       //        complete ios
-                                       //        (old value written to disk)
+      struct iocb *_iocb = ctx->iocbs[i];
+      if(IO_LANES && is_background_io(_iocb)) {
+         ctx->background_iocbs[nb_background++] = _iocb;
+         continue;
+      }
+      if(!prepare_iocb(ctx, _iocb)) {
+         ctx->iocbs[nb_held_back++] = _iocb;
+         continue;
+      }
+      ctx->submitted_iocbs[nb_submitted++] = _iocb;
+   }
 
-      add_time_in_payload(callback, 3);
+   // Background lane, only as many IOs as the budget allows
+   for(size_t i = 0; i < nb_background; i++) {
+      struct iocb *_iocb = ctx->background_iocbs[i];
+      if(ctx->background_in_flight >= background_budget(ctx) || !prepare_iocb(ctx, _iocb)) {
+         ctx->iocbs[nb_held_back++] = _iocb;
+         continue;
+      }
+      ctx->is_background[_iocb - ctx->iocb] = 1;
+      ctx->background_in_flight++;
+      ctx->submitted_iocbs[nb_submitted++] = _iocb;
+   }
+   ctx->nb_queued_ios = nb_held_back;
+   if(nb_submitted == 0)
+      return;
+
+   if(ADAPTIVE_QUEUE_DEPTH || IO_TRACE) {
+      uint64_t now;
+      rdtscll(now);
+      for(size_t i = 0; i < nb_submitted; i++)
+         ctx->submit_time[ctx->submitted_iocbs[i] - ctx->iocb] = now;
+      if(ctx->ios_in_flight + nb_submitted >= ctx->queue_depth)
+         ctx->qd.saturated = 1;
    }
 
+   size_t nb_requests = nb_submitted;
+   if(COALESCE_IOS)
+      nb_requests = coalesce_ios(ctx, nb_submitted);
+
    // Submit requests to the kernel
-   int ret = io_submit(ctx->ctx, pending, ctx->iocbs);
-   if (ret != pending)
-      perr("Couldn't submit all io requests! %d submitted / %lu (%lu sent, %lu processed)\n", ret, pending, ctx->sent_io, ctx->processed_io);
-   ctx->ios_sent_to_disk = ret;
+   int ret = engine_submit(ctx, nb_requests, ctx->submitted_iocbs);
+   if (ret != nb_requests)
+      perr("Couldn't submit all io requests! %d submitted / %lu (%lu in flight, %lu held back)\n", ret, nb_requests, ctx->ios_in_flight, nb_held_back);
+   ctx->ios_in_flight += nb_submitted;
 }
 
 
@@ -143,52 +678,90 @@ void do_io(void) {
 }
 
 /* We need a unique hash for each page for the page cache */
-static uint64_t get_hash_for_page(int fd, uint64_t page_num) {
+uint64_t get_hash_for_page(int fd, uint64_t page_num) {
    return (((uint64_t)fd)<<40LU)+page_num; // Works for files less than 40EB
 }
 
-/* Enqueue a request to read a page */
-char *read_page_async(struct slab_callback *callback) {
+/* Bitmap of nb sectors starting at sector first */
+static uint64_t sectors_mask(size_t first, size_t nb) {
+   return ((nb == 64)?~0LU:((1LU << nb) - 1)) << first;
+}
+
+/* Enqueue a request to read nb_sectors sectors of a page, starting at sector first_sector */
+char *read_sectors_async(struct slab_callback *callback, size_t first_sector, size_t nb_sectors) {
    int alread_used;
    struct lru *lru_entry;
    void *disk_page;
    uint64_t page_num = item_page_num(callback->slab, callback->slab_idx);
+   int fd = slab_page_fd(callback->slab, page_num);
+   off_t offset = slab_page_offset(callback->slab, page_num);
    struct io_context *ctx = get_io_context(callback->slab->ctx);
-   uint64_t hash = get_hash_for_page(callback->slab->fd, page_num);
+   uint64_t hash = get_hash_for_page(fd, offset / PAGE_SIZE);
+   uint64_t sectors = sectors_mask(first_sector, nb_sectors);
 
-   alread_used = get_page(get_pagecache(callback->slab->ctx), hash, &disk_page, &lru_entry);
+   alread_used = get_page(get_pagecache(callback->slab->ctx), hash, callback->hint, &disk_page, &lru_entry);
    callback->lru_entry = lru_entry;
-   if(lru_entry->contains_data) {   // content is cached already
+   if((lru_entry->valid_sectors & sectors) == sectors) {   // content is cached already
       callback->io_cb(callback);       // call the callback directly
       return disk_page;
    }
 
-   if(alread_used) { // Somebody else is already prefetching the same page!
-      struct linked_callbacks *linked_cb = malloc(sizeof(*linked_cb));
-      linked_cb->callback = callback;
-      linked_cb->next = ctx->linked_callbacks;
-      ctx->linked_callbacks = linked_cb; // link our callback
+   uint64_t missing = sectors & ~lru_entry->valid_sectors;
+   if(alread_used && !(missing & ~lru_entry->reading_sectors)) { // Somebody else is already prefetching the same sectors!
+      link_callback(ctx, lru_entry, callback, 0, sectors);
       return NULL;
    }
 
-   int buffer_idx = ctx->sent_io % ctx->max_pending_io;
-   struct iocb *_iocb = &ctx->iocb[buffer_idx];
-   memset(_iocb, 0, sizeof(*_iocb));
-   _iocb->aio_fildes = callback->slab->fd;
+   // Read the missing sectors. Valid sectors in the middle are read again, that's fine: a page that isn't fully valid is never modified.
+   size_t first = __builtin_ctzl(missing), last = 63 - __builtin_clzl(missing);
+   lru_entry->reading_sectors |= sectors_mask(first, last - first + 1);
+   lru_entry->nb_reads++;
+
+   struct iocb *_iocb = get_iocb(ctx);
+   _iocb->aio_fildes = fd;
    _iocb->aio_lio_opcode = IOCB_CMD_PREAD;
-   _iocb->aio_buf = (uint64_t)disk_page;
+   _iocb->aio_buf = (uint64_t)disk_page + first * SECTOR_SIZE;
    _iocb->aio_data = (uint64_t)callback;
-   _iocb->aio_offset = page_num * PAGE_SIZE;
-   _iocb->aio_nbytes = PAGE_SIZE;
-   if(ctx->sent_io - ctx->processed_io >= ctx->max_pending_io)
-      die("Sent %lu ios, processed %lu (> %lu waiting), IO buffer is too full!\n", ctx->sent_io, ctx->processed_io, ctx->max_pending_io);
-   ctx->sent_io++;
+   _iocb->aio_offset = offset + first * SECTOR_SIZE;
+   _iocb->aio_nbytes = (last - first + 1) * SECTOR_SIZE;
 
    return NULL;
 }
 
-/* Enqueue a request to write a page, the lru entry must contain the content of the page (obviously) */
-char *write_page_async(struct slab_callback *callback) {
+/* Enqueue a request to read a page */
+char *read_page_async(struct slab_callback *callback) {
+   return read_sectors_async(callback, 0, SECTORS_PER_PAGE);
+}
+
+/*
+ * Get a page without reading it, because it has never been written (it only contains 0s) or because it is going to be fully overwritten.
+ * The page is zeroed unless it is cached already.
+ */
+char *blank_page_async(struct slab_callback *callback) {
+   struct lru *lru_entry;
+   void *disk_page;
+   uint64_t page_num = item_page_num(callback->slab, callback->slab_idx);
+   uint64_t hash = get_hash_for_page(slab_page_fd(callback->slab, page_num), slab_page_offset(callback->slab, page_num) / PAGE_SIZE);
+
+   get_page(get_pagecache(callback->slab->ctx), hash, callback->hint, &disk_page, &lru_entry);
+   if(lru_entry->nb_reads) // a read of the page is in flight, it would overwrite our content, wait for it
+      return read_page_async(callback);
+
+   callback->lru_entry = lru_entry;
+   if(!lru_entry->contains_data) {
+      memset(disk_page, 0, PAGE_SIZE);
+      lru_entry->valid_sectors = ALL_SECTORS;
+      lru_entry->contains_data = 1;
+   }
+   callback->io_cb(callback);
+   return disk_page;
+}
+
+/*
+ * Enqueue a request to write nb_sectors sectors of a page, the lru entry must contain the content of the page (obviously)
+ * If a write of the page is already queued, it is extended to the new sectors.
+ */
+char *write_sectors_async(struct slab_callback *callback, size_t first_sector, size_t nb_sectors) {
    struct io_context *ctx = get_io_context(callback->slab->ctx);
    struct lru *lru_entry = callback->lru_entry;
    void *disk_page = lru_entry->page;
@@ -198,99 +771,437 @@ char *write_page_async(struct slab_callback *callback) {
       die("WTF?\n");
    }
 
+   lru_entry->dirty_sectors |= sectors_mask(first_sector, nb_sectors);
+
+   if(WRITE_BACK) { // the flusher will write the page later
+      mark_page_modified(get_pagecache(callback->slab->ctx), lru_entry);
+      callback->io_cb(callback);
+      return disk_page;
+   }
+
    if(lru_entry->dirty) { // this is the second time we write the page, which means it already has been queued for writting
-      struct linked_callbacks *linked_cb;
-      linked_cb = malloc(sizeof(*linked_cb));
-      linked_cb->callback = callback;
-      linked_cb->next = ctx->linked_callbacks;
-      ctx->linked_callbacks = linked_cb; // link our callback
+      uint64_t write_gen = lru_entry->write_gen + 1 + lru_entry->writing + lru_entry->nb_unflushed; // the queued write is durable after the ones in flight or waiting for a flush, if any
+      link_callback(ctx, lru_entry, callback, write_gen, 0);
       return disk_page;
    }
 
    lru_entry->dirty = 1;
 
-   int buffer_idx = ctx->sent_io % ctx->max_pending_io;
-   struct iocb *_iocb = &ctx->iocb[buffer_idx];
-   memset(_iocb, 0, sizeof(*_iocb));
-   _iocb->aio_fildes = callback->slab->fd;
+   struct iocb *_iocb = get_iocb(ctx);
+   _iocb->aio_fildes = slab_page_fd(callback->slab, page_num);
    _iocb->aio_lio_opcode = IOCB_CMD_PWRITE;
    _iocb->aio_buf = (uint64_t)disk_page;
    _iocb->aio_data = (uint64_t)callback;
-   _iocb->aio_offset = page_num * PAGE_SIZE;
-   _iocb->aio_nbytes = PAGE_SIZE;
-   if(ctx->sent_io - ctx->processed_io >= ctx->max_pending_io)
-      die("Sent %lu ios, processed %lu (> %lu waiting), IO buffer is too full!\n", ctx->sent_io, ctx->processed_io, ctx->max_pending_io);
-   ctx->sent_io++;
+   _iocb->aio_offset = slab_page_offset(callback->slab, page_num);
+   _iocb->aio_nbytes = PAGE_SIZE; // adjusted to the dirty sectors when submitted
 
    return NULL;
 }
 
+char *write_page_async(struct slab_callback *callback) {
+   return write_sectors_async(callback, 0, SECTORS_PER_PAGE);
+}
+
+/*
+ * Can the file do direct IOs of SECTOR_SIZE bytes?
+ */
+int sector_io_supported(int fd) {
+   static __thread char *sector;
+   if(!sector)
+      sector = aligned_alloc(PAGE_SIZE, PAGE_SIZE);
+   return pread(fd, sector + SECTOR_SIZE, SECTOR_SIZE, SECTOR_SIZE) == SECTOR_SIZE;
+}
+
 /*
  * Init an IO worker
  */
-struct io_context *worker_ioengine_init(size_t nb_callbacks) {
-   int ret;
+struct io_context *worker_ioengine_init(size_t worker_id, size_t nb_callbacks) {
    struct io_context *ctx = calloc(1, sizeof(*ctx));
    ctx->max_pending_io = nb_callbacks * 2;
    ctx->iocb = calloc(ctx->max_pending_io, sizeof(*ctx->iocb));
+   ctx->free_iocbs = calloc(ctx->max_pending_io, sizeof(*ctx->free_iocbs));
    ctx->iocbs = calloc(ctx->max_pending_io, sizeof(*ctx->iocbs));
+   ctx->submitted_iocbs = calloc(ctx->max_pending_io, sizeof(*ctx->submitted_iocbs));
+   ctx->background_iocbs = calloc(ctx->max_pending_io, sizeof(*ctx->background_iocbs));
+   ctx->is_background = calloc(ctx->max_pending_io, sizeof(*ctx->is_background));
+   ctx->queue_depth = QUEUE_DEPTH;
+   if(ADAPTIVE_QUEUE_DEPTH || IO_TRACE)
+      ctx->submit_time = calloc(ctx->max_pending_io, sizeof(*ctx->submit_time));
+   if(ADAPTIVE_QUEUE_DEPTH) {
+      ctx->qd.direction = -1;
+      rdtscll(ctx->qd.window_start);
+   }
+   if(IO_TRACE) {
+      char path[512];
+      sprintf(path, IO_TRACE_PATH, worker_id);
+      ctx->trace.fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      if(ctx->trace.fd == -1)
+         perr("Cannot create IO trace %s\n", path);
+      struct io_trace_header header = {
+         .magic = IO_TRACE_MAGIC,
+         .cycles_per_sec = us_to_cycles(1000000LU),
+         .worker_id = worker_id,
+         .record_size = sizeof(struct io_trace_record),
+      };
+      if(write(ctx->trace.fd, &header, sizeof(header)) != sizeof(header))
+         perr("Cannot write IO trace header\n");
+      ctx->trace.records = calloc(IO_TRACE_BUFFER, sizeof(*ctx->trace.records));
+   }
    ctx->events = calloc(ctx->max_pending_io, sizeof(*ctx->events));
+   if(DURABILITY == DURABILITY_GROUP_FLUSH) { // user callbacks + flush callbacks
+      ctx->gf.waiting = calloc(2*ctx->max_pending_io, sizeof(*ctx->gf.waiting));
+      ctx->gf.flushing = calloc(2*ctx->max_pending_io, sizeof(*ctx->gf.flushing));
+      ctx->gf.fds = calloc(2*ctx->max_pending_io, sizeof(*ctx->gf.fds));
+      ctx->gf.delay = us_to_cycles(GROUP_FLUSH_DELAY);
+   }
+   for(size_t i = 0; i < ctx->max_pending_io; i++)
+      put_iocb(ctx, &ctx->iocb[i]);
+   ctx->linked = calloc(ctx->max_pending_io, sizeof(*ctx->linked));
+   ctx->free_linked = calloc(ctx->max_pending_io, sizeof(*ctx->free_linked));
+   for(size_t i = 0; i < ctx->max_pending_io; i++)
+      ctx->free_linked[ctx->nb_free_linked++] = &ctx->linked[i];
+   if(WRITE_BACK) {
+      ctx->flush_callbacks = calloc(ctx->max_pending_io, sizeof(*ctx->flush_callbacks));
+      ctx->free_flush_callbacks = calloc(ctx->max_pending_io, sizeof(*ctx->free_flush_callbacks));
+      for(size_t i = 0; i < ctx->max_pending_io; i++)
+         ctx->free_flush_callbacks[ctx->nb_free_flush_callbacks++] = &ctx->flush_callbacks[i];
+   }
+   if(COALESCE_IOS) {
+      ctx->coalesced = calloc(ctx->max_pending_io, sizeof(*ctx->coalesced));
+      ctx->free_coalesced = calloc(ctx->max_pending_io, sizeof(*ctx->free_coalesced));
+      for(size_t i = 0; i < ctx->max_pending_io; i++)
+         ctx->free_coalesced[ctx->nb_free_coalesced++] = &ctx->coalesced[i];
+   }
 
-   ret = io_setup(ctx->max_pending_io, &ctx->ctx);
-   if(ret < 0)
-      perr("Cannot create aio setup\n");
+   engine_setup(ctx);
 
    return ctx;
 }
 
+/*
+ * Give the IO engine a chance to prepare the memory and files it will do IOs to / from.
+ * Only io_uring cares: registered buffers and files avoid pinning pages and looking up the file on every IO.
+ */
+void worker_ioengine_register_pagecache(struct io_context *ctx, struct pagecache *p) {
+#if IO_ENGINE == IO_URING
+   struct uring *r = &ctx->ring;
+   if(PAGECACHE_RESIZE) // fixed buffers are pinned: after a MADV_DONTNEED the kernel would keep doing IOs to the old pages
+      return;
+   size_t size = p->cached_data_size;
+   size_t nb_buffers = (size + IO_URING_FIXED_BUFFER_SIZE - 1) / IO_URING_FIXED_BUFFER_SIZE;
+   struct iovec *iovs = calloc(nb_buffers, sizeof(*iovs));
+   for(size_t i = 0; i < nb_buffers; i++) {
+      iovs[i].iov_base = p->cached_data + i*IO_URING_FIXED_BUFFER_SIZE;
+      iovs[i].iov_len = (i == nb_buffers - 1)?(size - i*IO_URING_FIXED_BUFFER_SIZE):IO_URING_FIXED_BUFFER_SIZE;
+   }
+   if(io_uring_register(r->fd, IORING_REGISTER_BUFFERS, iovs, nb_buffers) < 0) {
+      // Usually RLIMIT_MEMLOCK is too low. Not fatal, IOs will just be a bit more expensive.
+      printf("#WARNING! Cannot register the page cache as io_uring fixed buffers (%s), check ulimit -l\n", strerror(errno));
+   } else {
+      r->fixed_buffers = p->cached_data;
+      r->fixed_buffers_size = size;
+   }
+   free(iovs);
+#endif
+}
+
+void worker_ioengine_register_slabs(struct io_context *ctx, struct slab **slabs, size_t nb_slabs) {
+#if IO_ENGINE == IO_URING
+   struct uring *r = &ctx->ring;
+   size_t nb_files = nb_slabs * STRIPE_WIDTH;
+   int *fds = malloc(nb_files * sizeof(*fds));
+   int max_fd = 0;
+   for(size_t i = 0; i < nb_files; i++) {
+      fds[i] = slabs[i / STRIPE_WIDTH]->fds[i % STRIPE_WIDTH];
+      if(fds[i] > max_fd)
+         max_fd = fds[i];
+   }
+   if(io_uring_register(r->fd, IORING_REGISTER_FILES, fds, nb_files) < 0)
+      perr("Cannot register slab files in io_uring\n");
+
+   r->nb_fixed_files = max_fd + 1;
+   r->fixed_files = malloc(r->nb_fixed_files * sizeof(*r->fixed_files));
+   for(size_t i = 0; i < r->nb_fixed_files; i++)
+      r->fixed_files[i] = -1;
+   for(size_t i = 0; i < nb_files; i++)
+      r->fixed_files[fds[i]] = i;
+   free(fds);
+#endif
+}
+
+/*
+ * Write back flusher.
+ * Half of the iocbs are kept for user requests (each pending callback needs at most one), the flusher only uses the other half.
+ * @force: write all modified pages (shutdown)
+ */
+static int is_flush_callback(struct io_context *ctx, struct slab_callback *callback) {
+   return callback >= ctx->flush_callbacks && callback < &ctx->flush_callbacks[ctx->max_pending_io];
+}
+
+static int flush_page(struct io_context *ctx, struct pagecache *p, struct lru *lru_entry) {
+   if(ctx->nb_free_iocbs <= ctx->max_pending_io / 2 || !ctx->nb_free_flush_callbacks) // with group flush, written pages hold their callback until the fdatasync
+      return 0;
+
+   clear_page_modified(p, lru_entry);
+   if(lru_entry->dirty) // a write is already queued, it will write the latest content
+      return 1;
+   lru_entry->dirty = 1;
+
+   struct slab_callback *callback = ctx->free_flush_callbacks[--ctx->nb_free_flush_callbacks];
+   callback->lru_entry = lru_entry;
+
+   struct iocb *_iocb = get_iocb(ctx);
+   _iocb->aio_fildes = lru_entry->hash >> 40LU; // see get_hash_for_page
+   _iocb->aio_lio_opcode = IOCB_CMD_PWRITE;
+   _iocb->aio_buf = (uint64_t)lru_entry->page;
+   _iocb->aio_data = (uint64_t)callback;
+   _iocb->aio_offset = (lru_entry->hash & ((1LU << 40LU) - 1)) * PAGE_SIZE;
+   _iocb->aio_nbytes = PAGE_SIZE;
+   return 1;
+}
+
+void worker_ioengine_flush(struct io_context *ctx, struct pagecache *p, int force) {
+   if(!WRITE_BACK || !p->nb_modified_pages)
+      return;
+
+   size_t nb_pages = MAX_PAGE_CACHE/get_nb_workers();
+   size_t nb_flushed = 0;
+   uint64_t now;
+   rdtscll(now);
+
+   // Oldest modifications first: too old, too many modified pages, or shutdown
+   while(p->oldest_modified && (force || nb_flushed < WRITE_BACK_BATCH)) {
+      struct lru *oldest = p->oldest_modified;
+      int too_old = cycles_to_us(now - oldest->modified_at) >= WRITE_BACK_MAX_AGE * 1000LU;
+      int too_many = p->nb_modified_pages * 100 > nb_pages * WRITE_BACK_DIRTY_RATIO;
+      if(!force && !too_old && !too_many)
+         break;
+      if(!flush_page(ctx, p, oldest))
+         return;
+      nb_flushed++;
+   }
+
+   // Modified pages that are next in line for eviction cannot be evicted, write them before the page cache needs them
+   if(p->nb_pages < p->target_pages)
+      return;
+   size_t cursor = 0;
+   struct lru *lru_entry = eviction_candidate(p, &cursor);
+   for(size_t i = 0; lru_entry && i < WRITE_BACK_BATCH && nb_flushed < WRITE_BACK_BATCH; i++) {
+      if(lru_entry->modified) {
+         if(!flush_page(ctx, p, lru_entry))
+            return;
+         nb_flushed++;
+      }
+      lru_entry = eviction_candidate(p, &cursor);
+   }
+}
+
 /* Enqueue requests */
 void worker_ioengine_enqueue_ios(struct io_context *ctx) {
    worker_do_io(ctx); // Process IO queue
 }
 
-/* Get processed requests from disk and call callbacks */
-void worker_ioengine_get_completed_ios(struct io_context *ctx) {
+/*
+ * Get processed requests from disk.
+ * Only reaps what has already completed, unless wait is set; then blocks until at least one IO completes.
+ */
+void worker_ioengine_get_completed_ios(struct io_context *ctx, int wait) {
    int ret = 0;
    declare_debug_timer;
 
-   if(ctx->ios_sent_to_disk == 0)
+   if(ctx->ios_in_flight == 0)
       return;
 
    start_debug_timer {
-      ret = io_getevents(ctx->ctx, ctx->ios_sent_to_disk - ret, ctx->ios_sent_to_disk - ret, &ctx->events[ret], NULL);
-      if(ret != ctx->ios_sent_to_disk)
-         die("Problem: only got %d answers out of %lu enqueued IO requests\n", ret, ctx->ios_sent_to_disk);
+      ret = engine_getevents(ctx, wait?1:0, ctx->ios_in_flight, ctx->events);
+      if(ret < 0)
+         die("Problem: io_getevents failed with %d (%lu enqueued IO requests)\n", ret, ctx->ios_in_flight);
+      ctx->nb_events = ret;
    } stop_debug_timer(10000, "io_getevents took more than 10ms!!");
 }
 
+/* Adaptive queue depth controller, see the comment at the top of the file */
+static void adjust_queue_depth(struct io_context *ctx) {
+   uint64_t now;
+   rdtscll(now);
+   uint64_t elapsed = cycles_to_us(now - ctx->qd.window_start);
+   if(elapsed < ADAPTIVE_QUEUE_DEPTH_WINDOW * 1000LU)
+      return;
+
+   if(ctx->qd.saturated && ctx->qd.nb_completed) {
+      uint64_t throughput = ctx->qd.nb_completed * 1000000LU / elapsed;
+      uint64_t latency = cycles_to_us(ctx->qd.total_latency) / ctx->qd.nb_completed;
+      if(ctx->qd.prev_throughput) {
+         if(throughput * 100 > ctx->qd.prev_throughput * 105) {
+            // keep going
+         } else if(throughput * 100 < ctx->qd.prev_throughput * 95) {
+            ctx->qd.direction = -ctx->qd.direction;
+         } else if(latency * 100 > ctx->qd.prev_latency * 110) {
+            ctx->qd.direction = -1;
+         }
+      }
+      ctx->qd.prev_throughput = throughput;
+      ctx->qd.prev_latency = latency;
+
+      size_t step = ctx->queue_depth / 8;
+      if(step == 0)
+         step = 1;
+      if(ctx->qd.direction > 0)
+         ctx->queue_depth = (ctx->queue_depth + step > QUEUE_DEPTH)?QUEUE_DEPTH:(ctx->queue_depth + step);
+      else
+         ctx->queue_depth = (ctx->queue_depth < MIN_QUEUE_DEPTH + step)?MIN_QUEUE_DEPTH:(ctx->queue_depth - step);
+   }
+
+   ctx->qd.window_start = now;
+   ctx->qd.total_latency = 0;
+   ctx->qd.nb_completed = 0;
+   ctx->qd.saturated = 0;
+}
+
+/* A write is durable, acknowledge it */
+static void complete_write(struct io_context *ctx, struct slab_callback *callback) {
+   struct lru *lru_entry = callback->lru_entry;
+   lru_entry->write_gen++;
+   if(WRITE_BACK && is_flush_callback(ctx, callback))
+      ctx->free_flush_callbacks[ctx->nb_free_flush_callbacks++] = callback;
+   else
+      callback->io_cb(callback);
+   wake_waiters(ctx, lru_entry);
+}
+
+/* All the fdatasyncs of a group completed, the writes of the group are durable */
+static void complete_sync(struct io_context *ctx, struct iocb *cb, int64_t res) {
+   if(res < 0)
+      die("fdatasync of fd %u failed (%ld)\n", cb->aio_fildes, res);
+   ctx->ios_in_flight--;
+   put_iocb(ctx, cb);
+   if(--ctx->gf.nb_syncs)
+      return;
+
+   for(size_t i = 0; i < ctx->gf.nb_flushing; i++) {
+      ctx->gf.flushing[i]->lru_entry->nb_unflushed--;
+      complete_write(ctx, ctx->gf.flushing[i]);
+   }
+   ctx->gf.nb_flushing = 0;
+}
+
+/* Call the callbacks of processed requests */
+static void complete_page_io(struct io_context *ctx, struct iocb *cb) {
+   struct slab_callback *callback = (void*)cb->aio_data;
+   struct lru *lru_entry = callback->lru_entry;
+   if(cb->aio_lio_opcode == IOCB_CMD_PWRITE) {
+      lru_entry->writing = 0;
+   } else {
+      size_t first = (cb->aio_offset % PAGE_SIZE) / SECTOR_SIZE;
+      lru_entry->valid_sectors |= sectors_mask(first, cb->aio_nbytes / SECTOR_SIZE);
+      lru_entry->nb_reads--;
+      if(!lru_entry->nb_reads)
+         lru_entry->reading_sectors = 0;
+   }
+   lru_entry->contains_data = (lru_entry->valid_sectors == ALL_SECTORS);
+   //callback->lru_entry->dirty = 0; // done before
+   ctx->ios_in_flight--;
+   if(ADAPTIVE_QUEUE_DEPTH) {
+      uint64_t now;
+      rdtscll(now);
+      ctx->qd.total_latency += now - ctx->submit_time[cb - ctx->iocb];
+      ctx->qd.nb_completed++;
+   }
+   if(ctx->is_background[cb - ctx->iocb]) {
+      ctx->is_background[cb - ctx->iocb] = 0;
+      ctx->background_in_flight--;
+   }
+   put_iocb(ctx, cb); // before calling the callback, it might enqueue a new IO
+   if(cb->aio_lio_opcode != IOCB_CMD_PWRITE) {
+      callback->io_cb(callback);
+      wake_waiters(ctx, lru_entry);
+   } else if(DURABILITY == DURABILITY_GROUP_FLUSH) { // wait for the next group flush
+      if(!ctx->gf.nb_waiting)
+         rdtscll(ctx->gf.oldest);
+      lru_entry->nb_unflushed++;
+      ctx->gf.waiting[ctx->gf.nb_waiting++] = callback;
+   } else {
+      complete_write(ctx, callback);
+   }
+}
+
+/*
+ * IO trace.
+ * _iocb is the request that was sent to the kernel, possibly a coalesced IO, and submit_iocb one of the pages it contains (coalesced IOs have no submit time).
+ */
+void worker_ioengine_trace_flush(struct io_context *ctx) {
+   if(!IO_TRACE || !ctx->trace.nb_records)
+      return;
+   size_t size = ctx->trace.nb_records * sizeof(*ctx->trace.records);
+   if(write(ctx->trace.fd, ctx->trace.records, size) != size)
+      perr("Cannot write IO trace\n");
+   ctx->trace.nb_records = 0;
+}
+
+static void trace_io(struct io_context *ctx, struct iocb *_iocb, struct iocb *submit_iocb, size_t nb_bytes) {
+   uint64_t now, latency;
+   struct io_trace_record *r = &ctx->trace.records[ctx->trace.nb_records++];
+   rdtscll(now);
+   r->submit = ctx->submit_time[submit_iocb - ctx->iocb];
+   latency = now - r->submit;
+   r->latency = (latency > UINT32_MAX)?UINT32_MAX:latency;
+   r->offset = _iocb->aio_offset;
+   r->nbytes = nb_bytes;
+   r->fd = _iocb->aio_fildes;
+   if(_iocb->aio_lio_opcode == IOCB_CMD_PREADV)
+      r->opcode = IOCB_CMD_PREAD;
+   else if(_iocb->aio_lio_opcode == IOCB_CMD_PWRITEV)
+      r->opcode = IOCB_CMD_PWRITE;
+   else
+      r->opcode = _iocb->aio_lio_opcode;
+   if(ctx->trace.nb_records == IO_TRACE_BUFFER)
+      worker_ioengine_trace_flush(ctx);
+}
 
 void worker_ioengine_process_completed_ios(struct io_context *ctx) {
-   int ret = ctx->ios_sent_to_disk;
+   size_t ret = ctx->nb_events;
    declare_debug_timer;
 
-   if(ctx->ios_sent_to_disk == 0)
+   if(ret == 0)
       return;
 
-
    start_debug_timer {
       // Enqueue completed IO requests
+      ctx->nb_events = 0;
       for(size_t i = 0; i < ret; i++) {
          struct iocb *cb = (void*)ctx->events[i].obj;
-         struct slab_callback *callback = (void*)cb->aio_data;
-         assert(ctx->events[i].res == 4096); // otherwise page hasn't been read
-         callback->lru_entry->contains_data = 1;
-         //callback->lru_entry->dirty = 0; // done before
-         callback->io_cb(callback);
+         if(is_coalesced_io(ctx, cb)) { // split the vectored IO
+            struct coalesced_io *c = (void*)cb->aio_data;
+            maybe_unused size_t nb_bytes = 0;
+            for(size_t p = 0; p < c->nb_pages; p++)
+               nb_bytes += c->pages[p]->aio_nbytes;
+            assert(ctx->events[i].res == nb_bytes); // otherwise pages haven't been read
+            if(IO_TRACE)
+               trace_io(ctx, cb, c->pages[0], ctx->events[i].res);
+            for(size_t p = 0; p < c->nb_pages; p++)
+               complete_page_io(ctx, c->pages[p]);
+            ctx->free_coalesced[ctx->nb_free_coalesced++] = c;
+         } else if(cb->aio_lio_opcode == IOCB_CMD_FDSYNC) {
+            if(IO_TRACE)
+               trace_io(ctx, cb, cb, 0);
+            complete_sync(ctx, cb, ctx->events[i].res);
+         } else {
+            assert(ctx->events[i].res == cb->aio_nbytes); // otherwise page hasn't been read
+            if(IO_TRACE)
+               trace_io(ctx, cb, cb, cb->aio_nbytes);
+            complete_page_io(ctx, cb);
+         }
       }
 
-      // We might have "linked callbacks" so process them
-      process_linked_callbacks(ctx);
-   } stop_debug_timer(10000, "rest of worker_ioengine_process_completed_ios (%d requests)", ret);
-
-   // Ok, now the main thread can push more requests
-   ctx->processed_io += ctx->ios_sent_to_disk;
+      if(ADAPTIVE_QUEUE_DEPTH)
+         adjust_queue_depth(ctx);
+   } stop_debug_timer(10000, "rest of worker_ioengine_process_completed_ios (%lu requests)", ret);
 }
 
 int io_pending(struct io_context *ctx) {
-   return ctx->sent_io - ctx->processed_io;
+   return ctx->nb_queued_ios + ctx->ios_in_flight + ctx->gf.nb_waiting; // waiting writes need the worker to send their flush
+}
+
+size_t io_queue_depth(struct io_context *ctx) {
+   return ctx->queue_depth;
 }
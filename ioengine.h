@@ -2,19 +2,29 @@
 #define IOENGINE_H 1
 
 
-struct io_context *worker_ioengine_init(size_t nb_callbacks);
+struct io_context *worker_ioengine_init(size_t worker_id, size_t nb_callbacks);
+void worker_ioengine_register_pagecache(struct io_context *ctx, struct pagecache *p);
+void worker_ioengine_register_slabs(struct io_context *ctx, struct slab **slabs, size_t nb_slabs);
 
 void *safe_pread(int fd, off_t offset);
+uint64_t get_hash_for_page(int fd, uint64_t page_num);
 
 typedef void (io_cb_t)(struct slab_callback *);
 char *read_page_async(struct slab_callback *cb);
 char *write_page_async(struct slab_callback *cb);
+char *blank_page_async(struct slab_callback *cb);
+char *read_sectors_async(struct slab_callback *cb, size_t first_sector, size_t nb_sectors);
+char *write_sectors_async(struct slab_callback *cb, size_t first_sector, size_t nb_sectors);
+int sector_io_supported(int fd);
 
 int io_pending(struct io_context *ctx);
+size_t io_queue_depth(struct io_context *ctx);
 
 void worker_ioengine_enqueue_ios(struct io_context *ctx);
-void worker_ioengine_get_completed_ios(struct io_context *ctx);
+void worker_ioengine_get_completed_ios(struct io_context *ctx, int wait);
 void worker_ioengine_process_completed_ios(struct io_context *ctx);
+void worker_ioengine_flush(struct io_context *ctx, struct pagecache *p, int force);
+void worker_ioengine_trace_flush(struct io_context *ctx);
 
 
 
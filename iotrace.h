@@ -0,0 +1,27 @@
+#ifndef IOTRACE_H
+#define IOTRACE_H 1
+
+/*
+ * IO traces (IO_TRACE): every worker logs the IOs it sends to the kernel in its own file, replay.c re-issues them.
+ * A trace file is a struct io_trace_header followed by struct io_trace_records, in completion order.
+ */
+#define IO_TRACE_MAGIC 0x6352546c6c65764bLU // "KvellTRc"
+
+struct io_trace_header {
+   uint64_t magic;
+   uint64_t cycles_per_sec;   // timestamps of the trace are rdtsc values
+   uint32_t worker_id;
+   uint32_t record_size;      // sizeof(struct io_trace_record)
+};
+
+struct io_trace_record {
+   uint64_t submit;           // rdtsc when the IO was sent to the kernel
+   uint64_t offset;
+   uint32_t latency;          // cycles between submission and completion, saturated at UINT32_MAX
+   uint32_t nbytes;
+   uint16_t fd;
+   uint8_t opcode;            // IOCB_CMD_PREAD, IOCB_CMD_PWRITE or IOCB_CMD_FDSYNC; a coalesced IO is recorded as a single big IO
+   uint8_t pad[5];
+};
+
+#endif
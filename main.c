@@ -1,7 +1,7 @@
 #include "headers.h"
 
 int main(int argc, char **argv) {
-   int nb_disks, nb_workers_per_disk;
+   int nb_disks, nb_workers;
    declare_timer;
 
    /* Definition of the workload, if changed you need to erase the DB before relaunching */
@@ -15,15 +15,29 @@ int main(int argc, char **argv) {
 
    /* Parsing of the options */
    if(argc < 3)
-      die("Usage: ./main <nb disks> <nb workers per disk>\n\tData is stored in %s\n", PATH);
+      die("Usage: ./main <nb disks> <nb workers>\n\tData is stored in %s\n", PATH);
    nb_disks = atoi(argv[1]);
-   nb_workers_per_disk = atoi(argv[2]);
+   nb_workers = atoi(argv[2]);
+   if(nb_disks <= 0 || nb_workers <= 0)
+      die("Need at least 1 disk and 1 worker\n");
 
    /* Pretty printing useful info */
    printf("# Configuration:\n");
-   printf("# \tPage cache size: %lu GB\n", PAGE_CACHE_SIZE/1024/1024/1024);
-   printf("# \tWorkers: %d working on %d disks\n", nb_disks*nb_workers_per_disk, nb_disks);
-   printf("# \tIO configuration: %d queue depth (capped: %s, extra waiting: %s)\n", QUEUE_DEPTH, NEVER_EXCEED_QUEUE_DEPTH?"yes":"no", WAIT_A_BIT_FOR_MORE_IOS?"yes":"no");
+   printf("# \tPage cache size: %lu GB (%s)\n", PAGE_CACHE_SIZE/1024/1024/1024, PAGECACHE_GOVERNOR?"moving between workers":"same for all workers");
+   if(PAGECACHE_RESIZE)
+      printf("# \tPage cache resizing: %d%%-100%% of the size, follows the memory pressure every %dms\n", RESIZE_MIN_SHARE, RESIZE_PERIOD);
+   if(WARMUP)
+      printf("# \tPage cache warm-up: saved every %ds in %s\n", WARMUP_PERIOD, WARMUP_PATH);
+   if(PAGECACHE_COMPRESSED_SIZE)
+      printf("# \tCompressed page cache size: %lu MB\n", PAGECACHE_COMPRESSED_SIZE/1024/1024);
+   if(OBJECT_CACHE_SIZE)
+      printf("# \tObject cache size: %lu MB%s\n", OBJECT_CACHE_SIZE/1024/1024, OBJECT_CACHE_ADMISSION?" (items read twice)":"");
+   printf("# \tWorkers: %d working on %d disks\n", nb_workers, nb_disks);
+   printf("# \tStriping: each slab is striped over %d files\n", STRIPE_WIDTH);
+   printf("# \tIO engine: %s%s\n", IO_ENGINE==IO_URING?"io_uring":(IO_ENGINE==EMULATED?"emulated device":"linux aio"), (IO_ENGINE==IO_URING && IO_URING_SQPOLL)?" (SQPOLL)":"");
+   printf("# \tIO configuration: %d queue depth (adaptive: %s, capped: %s, extra waiting: %s)\n", QUEUE_DEPTH, ADAPTIVE_QUEUE_DEPTH?"yes":"no", NEVER_EXCEED_QUEUE_DEPTH?"yes":"no", WAIT_A_BIT_FOR_MORE_IOS?"yes":"no");
+   printf("# \tPage cache policy: %s, %s eviction%s%s\n", WRITE_BACK?"write back":"write through", PAGECACHE_EVICTION==CLOCK?"CLOCK":(PAGECACHE_EVICTION==S3FIFO?"S3-FIFO":"LRU"), PAGECACHE_ADMISSION?", TinyLFU admission":"", PAGECACHE_SCAN_RESISTANT?", scan resistant":"");
+   printf("# \tDurability: %s\n", DURABILITY==DURABILITY_FUA?"FUA writes":(DURABILITY==DURABILITY_GROUP_FLUSH?"group flush":"none (drive cache)"));
    printf("# \tQueue configuration: %d maximum pending callbaks per worker\n", MAX_NB_PENDING_CALLBACKS_PER_WORKER);
    printf("# \tDatastructures: %d (memory index) %d (pagecache)\n", MEMORY_INDEX, PAGECACHE_INDEX);
    printf("# \tThread pinning: %s\n", PINNING?"yes":"no");
@@ -37,7 +51,7 @@ int main(int argc, char **argv) {
 
    /* Recover database */
    start_timer {
-      slab_workers_init(nb_disks, nb_workers_per_disk);
+      slab_workers_init(nb_disks, nb_workers);
    } stop_timer("Init found %lu elements", get_database_size());
 
    /* Add missing items if any */
@@ -57,5 +71,8 @@ int main(int argc, char **argv) {
       }
       run_workload(&w, workload);
    }
+
+   /* Write back: modified pages must reach the disk */
+   slab_workers_shutdown();
    return 0;
 }
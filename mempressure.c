@@ -0,0 +1,141 @@
+#include "headers.h"
+
+/*
+ * Memory pressure (PAGECACHE_RESIZE).
+ *
+ * KVell shares the machine with other services: a page cache that doesn't shrink when memory runs low gets them (or KVell) OOM-killed.
+ * The pressure is read from the cgroup v2 files of the cgroup of KVell (found in /proc/self/cgroup):
+ * - memory.pressure: PSI, the total time during which some tasks were stalled waiting for memory (reclaim, refaults). The % of the time
+ *   stalled is computed over the last period from the total; the avg10 moving average would stay high for several periods after a single
+ *   stall and shrink the page cache again on each of them;
+ * - memory.events: the number of times the cgroup went over memory.high or hit memory.max (or was OOM-killed), any new event is pressure;
+ * - memory.max - memory.current: how much the cgroup can still allocate.
+ * Without cgroup v2 (or without a limit) the machine-wide /proc/pressure/memory and the MemAvailable of /proc/meminfo are used.
+ */
+static void read_cgroup_path(char *path, size_t size) {
+   char line[384];
+   path[0] = '\0';
+   FILE *f = fopen("/proc/self/cgroup", "r");
+   if(!f)
+      return;
+   while(fgets(line, sizeof(line), f)) {
+      if(strncmp(line, "0::", 3))
+         continue;
+      line[strcspn(line, "\n")] = '\0';
+      snprintf(path, size, "%s%s", RESIZE_CGROUP_ROOT, &line[3]);
+      break;
+   }
+   fclose(f);
+}
+
+/* us during which some tasks were stalled on memory since boot, 0 if unknown */
+static size_t read_stall_us(struct mempressure *m) {
+   size_t total = 0;
+   FILE *f = fopen(m->pressure_path, "r");
+   if(!f)
+      return 0;
+   if(fscanf(f, "some avg10=%*f avg60=%*f avg300=%*f total=%lu", &total) != 1)
+      total = 0;
+   fclose(f);
+   return total;
+}
+
+/* % of the time stalled on memory since the previous call */
+static size_t read_psi(struct mempressure *m) {
+   uint64_t now;
+   size_t stall_us = read_stall_us(m);
+   rdtscll(now);
+   size_t elapsed_us = cycles_to_us(now - m->last_check);
+   size_t stalled = (stall_us > m->last_stall_us)?(stall_us - m->last_stall_us):0;
+   m->last_stall_us = stall_us;
+   m->last_check = now;
+   return elapsed_us?(stalled * 100 / elapsed_us):0;
+}
+
+static size_t read_events(struct mempressure *m) {
+   char name[64];
+   size_t value, nb_events = 0;
+   if(!m->events_path[0])
+      return 0;
+   FILE *f = fopen(m->events_path, "r");
+   if(!f)
+      return 0;
+   while(fscanf(f, "%63s %lu", name, &value) == 2) {
+      if(!strcmp(name, "high") || !strcmp(name, "max") || !strcmp(name, "oom") || !strcmp(name, "oom_kill"))
+         nb_events += value;
+   }
+   fclose(f);
+   return nb_events;
+}
+
+void mempressure_init(struct mempressure *m) {
+   char cgroup[400];
+   read_cgroup_path(cgroup, sizeof(cgroup));
+   memset(m, 0, sizeof(*m));
+   snprintf(m->pressure_path, sizeof(m->pressure_path), "%s/memory.pressure", cgroup);
+   if(!cgroup[0] || access(m->pressure_path, R_OK)) {
+      printf("#WARNING! No cgroup v2 memory controller under %s, the page cache follows the memory pressure of the whole machine\n", RESIZE_CGROUP_ROOT);
+      strcpy(m->pressure_path, "/proc/pressure/memory");
+      if(access(m->pressure_path, R_OK))
+         printf("#WARNING! PSI is not available (%s), the page cache only follows the available memory\n", strerror(errno));
+   } else {
+      snprintf(m->events_path, sizeof(m->events_path), "%s/memory.events", cgroup);
+      snprintf(m->max_path, sizeof(m->max_path), "%s/memory.max", cgroup);
+      snprintf(m->current_path, sizeof(m->current_path), "%s/memory.current", cgroup);
+      m->last_events = read_events(m); // only the events from now on count
+   }
+   read_psi(m); // same for the stalls
+}
+
+/* @return 0 if the file doesn't exist or doesn't contain a number (memory.max is "max" without limit) */
+static size_t read_size(const char *path) {
+   size_t value = 0;
+   FILE *f = fopen(path, "r");
+   if(!f)
+      return 0;
+   if(fscanf(f, "%lu", &value) != 1)
+      value = 0;
+   fclose(f);
+   return value;
+}
+
+static size_t read_mem_available(void) {
+   char line[256];
+   size_t kb = 0;
+   FILE *f = fopen("/proc/meminfo", "r");
+   if(!f)
+      return 0;
+   while(fgets(line, sizeof(line), f)) {
+      if(sscanf(line, "MemAvailable: %lu kB", &kb) == 1)
+         break;
+   }
+   fclose(f);
+   return kb * 1024;
+}
+
+/* Bytes that can still be allocated */
+static size_t read_headroom(struct mempressure *m) {
+   size_t available = read_mem_available();
+   size_t max = m->max_path[0]?read_size(m->max_path):0;
+   if(max) {
+      size_t current = read_size(m->current_path);
+      size_t cgroup_headroom = (current < max)?(max - current):0;
+      if(cgroup_headroom < available)
+         return cgroup_headroom;
+   }
+   return available;
+}
+
+int mempressure_check(struct mempressure *m, size_t grow_bytes) {
+   size_t psi = read_psi(m);
+   size_t events = read_events(m);
+   size_t headroom = read_headroom(m);
+   int new_events = (events > m->last_events);
+   m->last_events = events;
+
+   if(psi >= RESIZE_PSI_HIGH || new_events || headroom < RESIZE_HEADROOM)
+      return -1;
+   if(psi < RESIZE_PSI_LOW && headroom > RESIZE_HEADROOM + grow_bytes)
+      return 1;
+   return 0;
+}
@@ -0,0 +1,19 @@
+#ifndef MEMPRESSURE_H
+#define MEMPRESSURE_H 1
+
+/*
+ * Memory pressure of the cgroup of KVell (see mempressure.c), read by the page cache resizer (PAGECACHE_RESIZE).
+ */
+struct mempressure {
+   char pressure_path[512];   // memory.pressure of the cgroup, or /proc/pressure/memory
+   char events_path[512];     // memory.events of the cgroup, empty without cgroup v2
+   char max_path[512], current_path[512];
+   size_t last_events;        // high + max + oom + oom_kill events of the cgroup at the previous check
+   size_t last_stall_us;      // PSI total of the some line at the previous check
+   uint64_t last_check;       // cycles
+};
+
+void mempressure_init(struct mempressure *m);
+int mempressure_check(struct mempressure *m, size_t grow_bytes); // @return -1 if the page cache should shrink, 1 if it can grow by grow_bytes, 0 otherwise
+
+#endif
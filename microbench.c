@@ -13,6 +13,7 @@
  */
 #define NB_THREADS 6
 #define NB_ACCESSES 5000000LU
+#define EMULATED_FILE_SIZE (1LU*1024*1024*1024) // Size of the benched file with IO_ENGINE == EMULATED
 
 #define RO 1 // read only
 #define WO 2 // write only
@@ -29,6 +30,25 @@ struct pdata {
 static char *path = NULL;
 static int nb_threads = 0;
 
+#if IO_ENGINE == EMULATED
+/* Bench the emulated device instead of a real drive, see ioengine-emulated.c */
+static int io_setup(unsigned nr, aio_context_t *ctxp) {
+   return emulated_io_setup(nr, ctxp);
+}
+
+static int io_destroy(aio_context_t ctx) {
+   return emulated_io_destroy(ctx);
+}
+
+static int io_submit(aio_context_t ctx, long nr, struct iocb **iocbpp) {
+   return emulated_io_submit(ctx, nr, iocbpp);
+}
+
+static int io_getevents(aio_context_t ctx, long min_nr, long max_nr,
+		struct io_event *events, struct timespec *timeout) {
+   return emulated_io_getevents(ctx, min_nr, max_nr, events);
+}
+#else
 static int io_setup(unsigned nr, aio_context_t *ctxp) {
 	return syscall(__NR_io_setup, nr, ctxp);
 }
@@ -45,6 +65,7 @@ static int io_getevents(aio_context_t ctx, long min_nr, long max_nr,
 		struct io_event *events, struct timespec *timeout) {
 	return syscall(__NR_io_getevents, ctx, min_nr, max_nr, events, timeout);
 }
+#endif
 
 void *do_libaio(void *data) {
    int tid = __sync_fetch_and_add(&nb_threads, 1);
@@ -70,6 +91,8 @@ void *do_libaio(void *data) {
       perror("io_setup");
       exit(-1);
    }
+   if(IO_ENGINE == EMULATED)
+      emulated_io_share_device(ctx, NB_THREADS); // all threads bench the same device
 
    declare_periodic_count;
    declare_breakdown;
@@ -145,7 +168,13 @@ int bench_io(void) {
    size_t nb_pages;
 
 
-   fd = open(path,  O_RDWR | O_CREAT | O_DIRECT, 0777);
+   if(IO_ENGINE == EMULATED) {
+      fd = emulated_open(path);
+      if(fd == -1 || ftruncate(fd, EMULATED_FILE_SIZE))
+         perr("Cannot create emulated file %s\n", path);
+   } else {
+      fd = open(path,  O_RDWR | O_CREAT | O_DIRECT, 0777);
+   }
    if(fd == -1)
       perr("Cannot open %s\n", path);
 
@@ -163,8 +192,10 @@ int bench_io(void) {
       }
    } stop_timer("DirectIO - Time for %lu accesses = %lums (%lu io/s)", NB_ACCESSES, elapsed/1000, NB_ACCESSES*1000000LU/elapsed);*/
 
-   close(fd);
-   fd = open(path,  O_RDWR | O_CREAT | O_NONBLOCK | O_DIRECT, 0777);
+   if(IO_ENGINE != EMULATED) {
+      close(fd);
+      fd = open(path,  O_RDWR | O_CREAT | O_NONBLOCK | O_DIRECT, 0777);
+   }
 
    /* libaio perf - various queue size */
    size_t queue_sizes[] = { 56 };
@@ -0,0 +1,167 @@
+#include "headers.h"
+
+/*
+ * Object cache: a per worker cache of hot items, in front of the page cache.
+ *
+ * The page cache keeps whole pages: with 100-400B items spread over the slabs by the hash of their key, a hot item usually
+ * costs a full 4KB frame. The object cache only keeps a copy of the item, so the same memory holds 10-40x more hot items.
+ * Reads are answered by the worker before going to the page cache (see worker_dequeue_requests); updates and deletes refresh
+ * or drop the copy when they modify the page (see slab.c), so the object cache never returns a stale item.
+ *
+ * Objects are appended in a log and evicted from its head, with a second chance: an object read since it was appended is moved
+ * to the tail instead of being evicted. An object that grows is dropped and appended again on its next reads, its space is reclaimed
+ * when the head reaches it. Objects are found with a hash table (indexes/hashtable.c), keyed like the page cache by (fd << 40) + slab_idx.
+ *
+ * With OBJECT_CACHE_ADMISSION only items that have been read twice recently are copied (a bitmap remembers the items read once and
+ * is reset when half full), so a scan or a uniform workload doesn't flush the hot items out.
+ */
+struct object {
+   uint64_t key;
+   uint32_t size;       // bytes used in the log, header included
+   uint8_t valid;       // 0 once the item has been dropped, its space is reclaimed by the eviction
+   uint8_t referenced;  // read since it was appended
+   // item
+};
+
+#define MIN_OBJECT_SIZE (sizeof(struct object) + sizeof(struct item_metadata) + sizeof(uint64_t))
+
+static uint64_t get_key(struct slab *s, size_t idx) {
+   return ((uint64_t)s->fds[0] << 40) + idx;
+}
+
+static size_t object_size(void *item) {
+   return sizeof(struct object) + (get_item_size(item) + 7) / 8 * 8;
+}
+
+struct objcache *objcache_init(size_t size) {
+   struct objcache *c = calloc(1, sizeof(*c));
+   c->size = size;
+   c->log = malloc(size);
+   if(!c->log)
+      die("Cannot allocate %lu bytes for the object cache -- see options.h\n", size);
+   c->index = hashtable_create(size / MIN_OBJECT_SIZE);
+
+   size_t nb_bits = 64;
+   while(nb_bits < 4 * (size / MIN_OBJECT_SIZE))
+      nb_bits *= 2;
+   c->doorkeeper_mask = nb_bits - 1;
+   c->doorkeeper = calloc(nb_bits / 64, sizeof(*c->doorkeeper));
+   return c;
+}
+
+static struct object *get_object(struct objcache *c, uint64_t key) {
+   struct index_entry *e = hashtable_lookup(c->index, key);
+   return e?(struct object *)&c->log[e->slab_idx]:NULL;
+}
+
+static void drop_object(struct objcache *c, struct object *o) {
+   hashtable_delete(c->index, o->key);
+   o->valid = 0;
+}
+
+/* Free the object at the head of the log, or give it a second chance. The log has wrapped: the free space is [tail, head). */
+static void evict_head(struct objcache *c) {
+   struct object *o = (struct object *)&c->log[c->head];
+   size_t size = o->size;
+   if(o->valid && o->referenced) {
+      // Move it to the tail: once the head has passed it, the free space is [tail, head + size), it cannot be overwritten by the move
+      o->referenced = 0;
+      struct index_entry e = { .slab = NULL, .slab_idx = c->tail };
+      hashtable_insert(c->index, o->key, &e);
+      memmove(&c->log[c->tail], o, size);
+      c->tail += size;
+   } else if(o->valid) {
+      hashtable_delete(c->index, o->key);
+      c->nb_evicted++;
+   }
+   c->head += size;
+   if(c->head == c->data_end) {
+      c->head = 0;
+      c->wrapped = 0;
+   }
+}
+
+/* @return the offset of size free contiguous bytes at the tail of the log */
+static size_t make_room(struct objcache *c, size_t size) {
+   while(1) {
+      if(!c->wrapped) {
+         if(c->size - c->tail >= size)
+            return c->tail;
+         c->data_end = c->tail;
+         c->tail = 0;
+         c->wrapped = 1;
+         if(c->head == c->data_end) { // empty log
+            c->head = 0;
+            c->wrapped = 0;
+         }
+      } else {
+         if(c->head - c->tail >= size)
+            return c->tail;
+         evict_head(c);
+      }
+   }
+}
+
+void *objcache_lookup(struct objcache *c, struct slab *s, size_t idx) {
+   struct object *o = get_object(c, get_key(s, idx));
+   if(!o) {
+      c->nb_misses++;
+      return NULL;
+   }
+   c->nb_hits++;
+   o->referenced = 1;
+   return &o[1];
+}
+
+/* Doorkeeper: @return 1 if the item was read recently, otherwise remember it */
+static int read_recently(struct objcache *c, uint64_t key) {
+   key ^= key >> 33; // murmur3 finalizer
+   key *= 0xff51afd7ed558ccdLU;
+   key ^= key >> 33;
+   size_t bit = key & c->doorkeeper_mask;
+   if(c->doorkeeper[bit / 64] & (1LU << (bit % 64)))
+      return 1;
+   c->doorkeeper[bit / 64] |= 1LU << (bit % 64);
+   if(++c->doorkeeper_nb_set > c->doorkeeper_mask / 2) {
+      memset(c->doorkeeper, 0, (c->doorkeeper_mask + 1) / 8);
+      c->doorkeeper_nb_set = 0;
+   }
+   return 0;
+}
+
+void objcache_admit(struct objcache *c, struct slab *s, size_t idx, void *item) {
+   struct item_metadata *meta = item;
+   if(meta->key_size == 0 || meta->key_size == -1) // not an item (READ_NO_LOOKUP of an empty or deleted spot)
+      return;
+
+   uint64_t key = get_key(s, idx);
+   size_t size = object_size(item);
+   if(size > c->size / 16) // the log must hold many objects for the second chance to work
+      return;
+   if(get_object(c, key))
+      return;
+   if(OBJECT_CACHE_ADMISSION && !read_recently(c, key))
+      return;
+
+   struct object *o = (struct object *)&c->log[make_room(c, size)];
+   o->key = key;
+   o->size = size;
+   o->valid = 1;
+   o->referenced = 0;
+   memcpy(&o[1], item, get_item_size(item));
+
+   struct index_entry e = { .slab = NULL, .slab_idx = c->tail };
+   hashtable_insert(c->index, key, &e);
+   c->tail += size;
+}
+
+void objcache_update(struct objcache *c, struct slab *s, size_t idx, void *item) {
+   struct item_metadata *meta = item;
+   struct object *o = get_object(c, get_key(s, idx));
+   if(!o)
+      return;
+   if(meta->key_size == -1 || object_size(item) > o->size)
+      drop_object(c, o);
+   else
+      memcpy(&o[1], item, get_item_size(item));
+}
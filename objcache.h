@@ -0,0 +1,31 @@
+#ifndef OBJCACHE_H
+#define OBJCACHE_H 1
+
+#include "indexes/hashtable.h"
+
+struct slab;
+
+/*
+ * Object cache of a worker (see objcache.c). Like the page cache, it is only used by the worker that owns it.
+ */
+struct objcache {
+   char *log;                 // objects, appended at the tail and evicted at the head
+   size_t size;
+   size_t head, tail;
+   size_t data_end;           // when the log has wrapped: end of the objects that are before the tail
+   int wrapped;               // the tail is before the head, objects are in [head, data_end) and [0, tail)
+   hashtable_t *index;        // item -> offset of its object in the log
+
+   uint64_t *doorkeeper;      // OBJECT_CACHE_ADMISSION: items read once recently
+   size_t doorkeeper_mask;    // number of bits - 1
+   size_t doorkeeper_nb_set;
+
+   size_t nb_hits, nb_misses, nb_evicted;
+};
+
+struct objcache *objcache_init(size_t size);
+void *objcache_lookup(struct objcache *c, struct slab *s, size_t idx); // the item is only valid until the next call to the object cache
+void objcache_admit(struct objcache *c, struct slab *s, size_t idx, void *item); // item read from the page cache
+void objcache_update(struct objcache *c, struct slab *s, size_t idx, void *item); // item written in the page cache (or deleted)
+
+#endif
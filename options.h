@@ -10,14 +10,61 @@
 #define RAX 1
 #define ART 2
 #define BTREE 3
+#define HASHTABLE 4 // Fixed size open addressing table, point lookups only: PAGECACHE_INDEX only
 
 #define MEMORY_INDEX BTREE
-#define PAGECACHE_INDEX BTREE
+#define PAGECACHE_INDEX HASHTABLE
+
+/* IO engine */
+#define LINUX_AIO 0
+#define IO_URING 1
+#define EMULATED 2 // No drive: slabs live in RAM and IOs complete after a modeled delay, see ioengine-emulated.c
+
+#define IO_ENGINE LINUX_AIO
+#define AIO_RING_POLLING 1 // Linux AIO: reap completions directly from the completion ring mapped by the kernel, only call io_getevents to sleep
+#define AIO_RING_SPIN 20 // us, when a worker has to wait for an IO, it polls the ring that long before sleeping in io_getevents
+#define IO_URING_SQPOLL 0 // Let a kernel thread poll the submission ring, submitting IOs then doesn't cost a syscall (burns one core per worker, only makes sense with PINNING)
+#define IO_URING_SQPOLL_IDLE 1000 // ms of inactivity before the kernel polling thread goes to sleep
+#define IO_TRACE 0 // Log every IO sent by the workers to IO_TRACE_PATH (one file per worker), replay them with ./replay
+#define IO_TRACE_PATH "/tmp/kvell-trace-%lu"
+#define WARMUP 0 // Every worker saves the list of the pages in its page cache in WARMUP_PATH every WARMUP_PERIOD s (and at shutdown), and reads them back in its page cache when it starts (see warmup.c)
+#define WARMUP_PATH "/scratch%lu/kvell/warmup-%d" // disk, worker
+#define WARMUP_PERIOD 60 // s
+#define WARMUP_MAX_GAP 8 // pages: saved pages of a file that are that close are read with a single IO, the pages in between are read for nothing
+#define WARMUP_MAX_IO 64 // pages read at once
+#define IO_TRACE_BUFFER 65536 // IOs recorded in memory before the worker writes them to its trace file
+#define COALESCE_IOS 1 // Merge IOs to contiguous pages of the same file into a single vectored IO (appends, scans, ...)
+#define MAX_COALESCED_PAGES 32 // Maximum size of a merged IO, in pages
+
+/* Durability of writes, see ioengine.c */
+#define DURABILITY_NONE 0 // A write is acknowledged when the drive acknowledges it, it might still be in the volatile cache of the drive
+#define DURABILITY_FUA 1 // Writes are sent with RWF_DSYNC (FUA on drives that support it), the write is durable when acknowledged
+#define DURABILITY_GROUP_FLUSH 2 // Completed writes wait for a fdatasync of their file before being acknowledged, one fdatasync covers many writes
+
+#define DURABILITY DURABILITY_NONE
+#define GROUP_FLUSH_SIZE 32 // DURABILITY_GROUP_FLUSH: flush as soon as that many writes are waiting...
+#define GROUP_FLUSH_DELAY 200 // us, ... or when the oldest waiting write has waited that long (or when no IO is in flight)
+
+/* Emulated device (IO_ENGINE == EMULATED) */
+#define EMULATED_FIXED 0
+#define EMULATED_LOGNORMAL 1
+#define EMULATED_QUEUE_DEPENDENT 2
+
+#define EMULATED_LATENCY_MODEL EMULATED_LOGNORMAL
+#define EMULATED_LATENCY 80 // us, latency of an IO (median for the lognormal model, latency at low queue depth for the queue dependent model)
+#define EMULATED_LATENCY_SIGMA 0.5 // lognormal model: standard deviation of log(latency)
+#define EMULATED_QUEUE_KNEE 32 // queue dependent model: latency grows linearly once more IOs than that are in flight
+#define EMULATED_BANDWIDTH 2048 // MB/s of a device, shared by the workers of the disk; 0 = unlimited
 
 /* Queue depth management */
-#define QUEUE_DEPTH 64
+#define QUEUE_DEPTH 64 // Maximum queue depth (and initial queue depth with ADAPTIVE_QUEUE_DEPTH)
+#define ADAPTIVE_QUEUE_DEPTH 1 // Each worker measures completion latency and throughput and moves its queue depth between MIN_QUEUE_DEPTH and QUEUE_DEPTH to stay at the latency knee of the drive
+#define MIN_QUEUE_DEPTH 4
+#define ADAPTIVE_QUEUE_DEPTH_WINDOW 100 // ms of measurements between two adjustments of the queue depth
 #define MAX_NB_PENDING_CALLBACKS_PER_WORKER (4*QUEUE_DEPTH)
 #define NEVER_EXCEED_QUEUE_DEPTH 1 // Never submit more than QUEUE_DEPTH IO requests simultaneously, otherwise up to 2*MAX_NB_PENDING_CALLBACKS_PER_WORKER (very unlikely)
+#define IO_LANES 1 // Reads that block user requests are submitted first, writes and scan reads are background IOs throttled by BACKGROUND_IO_SHARE
+#define BACKGROUND_IO_SHARE 50 // % of the queue depth that background IOs can use
 #define WAIT_A_BIT_FOR_MORE_IOS 0 // If we realize we don't have QUEUE_DEPTH IO pending when submitting IOs, check again if new incoming requests have arrived. Boost performance a tiny bit for zipfian workloads on AWS, but really not worthwhile
 
 /* Page cache */
@@ -26,6 +73,53 @@
 //#define PAGE_CACHE_SIZE (PAGE_SIZE * 2621440) //10GB
 //#define PAGE_CACHE_SIZE (PAGE_SIZE * 786432) //3GB
 #define MAX_PAGE_CACHE (PAGE_CACHE_SIZE / PAGE_SIZE)
+#define HUGEPAGES_NONE 0
+#define HUGEPAGES_THP 1 // Transparent huge pages (madvise)
+#define HUGEPAGES_HUGETLB 2 // Reserved huge pages (MAP_HUGETLB, needs vm.nr_hugepages), falls back to transparent huge pages if the reservation fails
+#define PAGECACHE_HUGEPAGES HUGEPAGES_THP
+#define PAGECACHE_NUMA_LOCAL 1 // The page cache of a worker is allocated on the NUMA node of its core (with PAGECACHE_GOVERNOR the shared arena is interleaved over all nodes)
+#define PAGECACHE_PREFAULT 0 // Fault the page cache at startup (each worker faults its own, in parallel) instead of on first use
+#define LRU 0 // Pages are moved to the head of a list on every hit
+#define CLOCK 1 // A hit sets a reference bit, a hand sweeps the pages and evicts the first one without its bit (the bit is cleared as the hand passes)
+#define S3FIFO 2 // New pages go to a small FIFO, pages hit there move to a main FIFO, pages evicted from the small FIFO are remembered in a ghost FIFO
+#define PAGECACHE_EVICTION LRU
+#define S3FIFO_SMALL_RATIO 10 // % of the page cache used by the small FIFO of S3FIFO
+#define PAGECACHE_ADMISSION 0 // TinyLFU: a new page only replaces the victim of the eviction policy if it was accessed more often recently (count-min sketch), otherwise it goes to a small transient buffer. LRU or CLOCK only, S3FIFO filters new pages already
+#define ADMISSION_TRANSIENT_RATIO 1 // % of the page cache used by the transient buffer
+#define ADMISSION_SAMPLE 10 // the counters of the sketch are halved after ADMISSION_SAMPLE accesses per page of the cache
+#define PAGECACHE_SCAN_RESISTANT 1 // Pages read by scans are inserted where they are evicted first (in the transient buffer with PAGECACHE_ADMISSION) and scan hits don't promote pages, so scans don't flush the pages of point reads
+#define SCAN_GHOSTS 100 // % of the page cache: the last pages inserted by scans are remembered, a scan that misses one of them again inserts it like a point read
+#define PAGECACHE_GOVERNOR 0 // Page frames move between the page caches of the workers: a thread gives frames of the caches that gain least from their last pages to the caches that would gain most from more pages. The total stays PAGE_CACHE_SIZE
+#define GOVERNOR_PERIOD 100 // ms between two moves
+#define GOVERNOR_STEP 1 // % of the fair share of a worker (PAGE_CACHE_SIZE/nb_workers) moved at once
+#define GOVERNOR_MIN_SHARE 25 // % of the fair share that a worker always keeps
+#define GOVERNOR_MAX_SHARE 200 // % of the fair share that a worker can get (the metadata of the page cache of every worker is sized for it)
+#define GOVERNOR_SHADOW 10 // % of the fair share: the gain of a bigger cache is measured as the misses on the last pages evicted
+#define PAGECACHE_RESIZE 0 // The size of the page cache follows the memory pressure of the cgroup of KVell (PSI and memory.events, see mempressure.c): frames are given back to the kernel (MADV_DONTNEED) under pressure and taken again when memory is available. PAGE_CACHE_SIZE is the maximum size. Disables io_uring fixed buffers, incompatible with HUGEPAGES_HUGETLB
+#define RESIZE_PERIOD 1000 // ms between two checks of the memory pressure
+#define RESIZE_STEP 5 // % of PAGE_CACHE_SIZE given back or taken again at once
+#define RESIZE_MIN_SHARE 10 // % of PAGE_CACHE_SIZE that the page cache always keeps
+#define RESIZE_PSI_HIGH 10 // % of the time some tasks of the cgroup stalled on memory since the previous check above which the page cache shrinks
+#define RESIZE_PSI_LOW 1 // % below which the page cache may grow
+#define RESIZE_HEADROOM (1LU*1024*1024*1024) // Bytes, the page cache shrinks when less memory is available (memory.max - memory.current of the cgroup, or MemAvailable) and only grows when a step more is
+#define RESIZE_CGROUP_ROOT "/sys/fs/cgroup" // Mount point of cgroup v2; without it the memory pressure of the whole machine is used
+#define SECTOR_IO 1 // Slabs whose items fit in a sector read / write the sectors of an item instead of the whole page (if the drive supports SECTOR_SIZE direct IOs)
+#define SECTOR_SIZE 512
+#define WRITE_BACK 0 // Updates only modify the cached page and a flusher writes modified pages in batches (otherwise every update is written to disk before being acknowledged)
+#define WRITE_BACK_MAX_AGE 1000 // ms, durability bound: a modified page is sent to disk at most that long after its first modification
+#define WRITE_BACK_DIRTY_RATIO 25 // % of the page cache that can be modified before the flusher starts writing the oldest modified pages
+#define WRITE_BACK_BATCH 64 // Maximum number of pages sent to disk by the flusher at once
+#define PAGECACHE_COMPRESSED_SIZE (0LU) // Bytes, split between the workers, 0 to disable. Pages evicted from the page cache are compressed and kept in RAM, a miss looks there before reading from disk (see zcache.c). In addition to PAGE_CACHE_SIZE
+
+/* Object cache */
+#define OBJECT_CACHE_SIZE (0LU) // Bytes, split between the workers, 0 to disable. Hot items are copied out of their page and served without going through the page cache: the same RAM holds many more hot items than whole pages do (see objcache.c). In addition to PAGE_CACHE_SIZE
+#define OBJECT_CACHE_ADMISSION 1 // Only items read twice recently are copied in the object cache (otherwise every item read from the page cache is)
+
+/* Slabs */
+#define STRIPE_WIDTH 1 // Each slab is striped page by page over that many files, on consecutive disks starting with the disk of the worker (see slab.c)
+#define SLAB_PREALLOCATION 1 // A background thread extends slab files ahead of the insert rate, workers only call fallocate when it lags behind
+#define SLAB_PREALLOCATION_AHEAD 2000 // ms of inserts, at the current insert rate of the slab, that must fit in the space already allocated
+#define SLAB_PREALLOCATION_PERIOD 10 // ms between two checks of the extender
 
 /* Free list */
 #define FREELIST_IN_MEMORY_ITEMS (256) // We need enough to never have to read from disk
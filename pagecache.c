@@ -1,4 +1,5 @@
 #include "headers.h"
+#include <linux/mempolicy.h>
 
 /*
  * Basic page cache implementation.
@@ -14,31 +15,227 @@
  * The lru entry is used to have a lru order of cached content + some metadata.
  * lru_entry.dirty = the page has been written but not flushed
  * lru_entry.contains_data = the page already contains the correct content, no need to read page from disk
+ * lru_entry.valid_sectors = same thing at sector granularity, pages of slabs doing sector IOs might only be partially read
+ * lru_entry.nb_reads = number of reads of (part of) the page in flight
+ * lru_entry.writing = a write of the page has been sent to disk and has not completed yet
+ * lru_entry.nb_unflushed = (group flush only) writes of the page have completed but are not durable yet
+ * lru_entry.waiters = requests waiting for the IOs of the page in flight; a page with waiters always has IOs in flight, so it is busy
+ * lru_entry.modified = (write back only) the page has been updated in memory, the flusher of the IO engine will write it later
  * These metadata are cleared by the page cache and set by the IO engine.
  *
+ * Eviction (PAGECACHE_EVICTION):
+ * - LRU: the lru entries form a doubly linked list that is reordered on every hit;
+ * - CLOCK and S3FIFO: a hit only updates the byte of the page in the dense freq array; the list is not used.
+ *   CLOCK sweeps the pages in index order. S3FIFO keeps 2 FIFOs of page indexes and a ghost FIFO of hashes:
+ *   a new page enters the small FIFO, or the main FIFO if its hash is a ghost (it was evicted recently);
+ *   at the end of the small FIFO a page that was hit moves to the main FIFO, otherwise it is evicted and becomes a ghost;
+ *   at the end of the main FIFO a page that was hit is reinserted with one less hit, otherwise it is evicted.
+ * Busy pages are skipped by all policies.
+ *
+ * Admission (PAGECACHE_ADMISSION, TinyLFU): every access is counted in a count-min sketch whose counters are halved periodically, so it
+ * estimates how often a page was accessed recently. On a miss the new page replaces the victim chosen by the eviction policy only if
+ * its estimate is higher than the estimate of the victim. Otherwise the victim stays and the new page goes to one of the transient pages,
+ * the last pages of the cache, reused in FIFO order. Transient pages are indexed like the others, so concurrent requests share them.
+ *
+ * Governor (PAGECACHE_GOVERNOR): the frames (the memory of the pages) of all the workers come from a shared arena. Every worker remembers
+ * the pages it evicted last (the shadow); the misses on them are the hits a bigger cache would have had. Periodically the governor moves
+ * target_pages from the worker with the fewest shadow hits to the worker with the most. The hand-off of a frame goes through the frame pool:
+ * a worker above its target evicts pages at a safe point of its loop (page_cache_release_frames) and puts their frames in the pool,
+ * a worker below its target takes frames from the pool on misses instead of evicting. A frame belongs either to one worker or to the pool.
+ *
+ * Scans (PAGECACHE_SCAN_RESISTANT): the pages read by scans (ACCESS_SCAN) are usually read once, they must not replace the pages of point reads.
+ * A page brought in by a scan goes where the policy evicts first: at the oldest end of the LRU list, under the hand of CLOCK (the next eviction
+ * looks at it first), in the small FIFO of S3FIFO even if it is a ghost; with PAGECACHE_ADMISSION it goes to the transient pages. A scan hit
+ * never promotes a page. A scanned page is only promoted by a point read hit, or by a scan that misses it again while it is one of the scan
+ * ghosts (the pages inserted by the last scans): it is then inserted like the page of a point read.
+ *
+ * Resizing (PAGECACHE_RESIZE): a thread follows the memory pressure (see mempressure.c) and changes the target_pages of all the workers
+ * by RESIZE_STEP % of PAGE_CACHE_SIZE at once, between RESIZE_MIN_SHARE % and 100 %. Frames are given back like with the governor, by
+ * page_cache_release_frames. The frames a cache releases because of resizing (its frames_to_trim, not the frames moved by the governor,
+ * which are used again right away) are also given back to the kernel (MADV_DONTNEED), so that the memory really leaves the process.
+ * When the governor gives pages to a cache that still had frames to give back, the donor gives them back instead. In the frame pool the
+ * frames given back stay below the frames still in memory, so the receivers get the frames in memory first. A frame taken again is faulted again, it doesn't have to be zeroed: pages are always read or blanked before use.
+ * Frames are 4KB: with transparent huge pages, giving one back splits its huge page (khugepaged may merge it again later); frames
+ * cannot be given back from reserved huge pages, PAGECACHE_RESIZE doesn't work with HUGEPAGES_HUGETLB.
+ *
+ * Compressed tier (PAGECACHE_COMPRESSED_SIZE): evicted pages that contain valid data are compressed in the zcache of the worker,
+ * and a miss takes the page back from there if it can (see zcache.c). A page is never in both.
+ *
  * The page cache shouldn't be used directly, the interface of the IO engine is a more convenient way to access data.
  */
 
-void page_cache_init(struct pagecache *p) {
+#if PAGECACHE_ADMISSION && PAGECACHE_EVICTION == S3FIFO
+#error "PAGECACHE_ADMISSION only works with LRU or CLOCK eviction"
+#endif
+#if PAGECACHE_RESIZE && PAGECACHE_HUGEPAGES == HUGEPAGES_HUGETLB
+#error "PAGECACHE_RESIZE gives 4KB frames back to the kernel, it doesn't work with HUGEPAGES_HUGETLB"
+#endif
+#define SKETCH_DEPTH 4
+#define SKETCH_MAX_COUNT 15 // 4-bit counters, 2 per byte
+#define SKETCH_WIDTH_PER_PAGE 4
+
+/*
+ * PAGECACHE_GOVERNOR: frames that belong to no worker
+ */
+static char *arena;
+static void **free_frames;
+static size_t nb_free_frames, nb_trimmed_frames; // free_frames[0..nb_trimmed_frames[ have been given back to the kernel (PAGECACHE_RESIZE)
+static pthread_spinlock_t frame_pool_lock;
+static pthread_once_t arena_once = PTHREAD_ONCE_INIT;
+
+/*
+ * Memory of the page cache. It is mapped, not allocated: nothing is faulted until a page is used (unless PAGECACHE_PREFAULT),
+ * so starting is instantaneous and the memory ends up on the node chosen by the memory policy, not on the node of whoever zeroes it.
+ */
+#define HUGE_PAGE_SIZE (2LU*1024*1024)
+static char *alloc_cached_data(size_t size, int interleave) {
+   char *mem = MAP_FAILED;
+   if(PAGECACHE_HUGEPAGES == HUGEPAGES_HUGETLB) {
+      mem = mmap(NULL, (size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+      if(mem == MAP_FAILED)
+         printf("#WARNING! Cannot reserve huge pages for the page cache (%s), check /proc/sys/vm/nr_hugepages. Using transparent huge pages.\n", strerror(errno));
+   }
+   if(mem == MAP_FAILED) {
+      mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if(mem == MAP_FAILED)
+         perr("Cannot map %lu bytes for the page cache, is the page cache bigger than RAM? -- see options.h\n", size);
+      if(PAGECACHE_HUGEPAGES != HUGEPAGES_NONE && madvise(mem, size, MADV_HUGEPAGE))
+         printf("#WARNING! Transparent huge pages are not available for the page cache (%s)\n", strerror(errno));
+   }
+
+   if(PAGECACHE_NUMA_LOCAL) {
+      unsigned long nodemask = ~0LU;
+      unsigned cpu, node;
+      int mode = MPOL_INTERLEAVE;
+      if(!interleave) { // workers are pinned before they create their page cache, the current node is theirs
+         syscall(__NR_getcpu, &cpu, &node, NULL);
+         nodemask = 1LU << node;
+         mode = MPOL_PREFERRED;
+      }
+      if(syscall(__NR_mbind, mem, size, mode, &nodemask, sizeof(nodemask)*8, 0))
+         printf("#WARNING! Cannot set the NUMA policy of the page cache (%s)\n", strerror(errno));
+   }
+
+   if(PAGECACHE_PREFAULT) {
+#ifdef MADV_POPULATE_WRITE
+      if(!madvise(mem, size, MADV_POPULATE_WRITE))
+         return mem;
+#endif
+      for(size_t i = 0; i < size; i += PAGE_SIZE)
+         mem[i] = 0;
+   }
+   return mem;
+}
+
+static void init_arena(void) {
    declare_timer;
    start_timer {
       printf("#Reserving memory for page cache...\n");
-      p->cached_data = aligned_alloc(PAGE_SIZE, PAGE_CACHE_SIZE/get_nb_workers());
-      assert(p->cached_data); // If it fails here, it's probably because page cache size is bigger than RAM -- see options.h
-      memset(p->cached_data, 0, PAGE_CACHE_SIZE/get_nb_workers());
+      arena = alloc_cached_data(PAGE_CACHE_SIZE, 1);
    } stop_timer("Page cache initialization");
+   free_frames = malloc(MAX_PAGE_CACHE * sizeof(*free_frames));
+   for(size_t i = 0; i < MAX_PAGE_CACHE; i++)
+      free_frames[nb_free_frames++] = &arena[PAGE_SIZE*(MAX_PAGE_CACHE - 1 - i)];
+   pthread_spin_init(&frame_pool_lock, PTHREAD_PROCESS_PRIVATE);
+}
+
+static void *get_frame(void) {
+   void *frame = NULL;
+   pthread_spin_lock(&frame_pool_lock);
+   if(nb_free_frames)
+      frame = free_frames[--nb_free_frames];
+   if(nb_trimmed_frames > nb_free_frames)
+      nb_trimmed_frames = nb_free_frames;
+   pthread_spin_unlock(&frame_pool_lock);
+   return frame;
+}
+
+static void put_frame(void *frame, int trimmed) {
+   pthread_spin_lock(&frame_pool_lock);
+   if(trimmed) { // goes below the frames still in memory
+      free_frames[nb_free_frames++] = free_frames[nb_trimmed_frames];
+      free_frames[nb_trimmed_frames++] = frame;
+   } else {
+      free_frames[nb_free_frames++] = frame;
+   }
+   pthread_spin_unlock(&frame_pool_lock);
+}
+
+static void init_ghosts(struct ghosts *g, size_t size) {
+   g->size = size?size:1;
+   g->hashes = calloc(g->size, sizeof(*g->hashes));
+   g->index = hashtable_create(g->size);
+   g->nb = 0;
+}
+
+void page_cache_init(struct pagecache *p) {
+   size_t fair_share = MAX_PAGE_CACHE/get_nb_workers();
+   if(PAGECACHE_GOVERNOR) {
+      pthread_once(&arena_once, init_arena);
+      p->cached_data = arena;
+      p->cached_data_size = PAGE_CACHE_SIZE;
+   } else {
+      declare_timer;
+      start_timer {
+         printf("#Reserving memory for page cache...\n");
+         p->cached_data = alloc_cached_data(PAGE_CACHE_SIZE/get_nb_workers(), 0);
+      } stop_timer("Page cache initialization");
+      p->cached_data_size = PAGE_CACHE_SIZE/get_nb_workers();
+   }
 
-   p->hash_to_page = tree_create();
-   p->used_pages = calloc(MAX_PAGE_CACHE/get_nb_workers(), sizeof(*p->used_pages));
+   p->nb_transient_pages = 0;
+   if(PAGECACHE_ADMISSION) {
+      p->nb_transient_pages = fair_share * ADMISSION_TRANSIENT_RATIO / 100;
+      if(!p->nb_transient_pages)
+         p->nb_transient_pages = 1;
+   }
+   p->target_pages = fair_share - p->nb_transient_pages;
+   p->max_pages = PAGECACHE_GOVERNOR?(fair_share * GOVERNOR_MAX_SHARE / 100):p->target_pages;
+   p->nb_pages = 0;
+   size_t max_pages = p->max_pages;
+   p->hash_to_page = tree_create(max_pages + p->nb_transient_pages);
+   p->used_pages = calloc(max_pages + p->nb_transient_pages, sizeof(*p->used_pages));
    p->used_page_size = 0;
    p->oldest_page = NULL;
    p->newest_page = NULL;
+   p->freq = calloc(max_pages, sizeof(*p->freq));
+   p->hand = 0;
+   if(PAGECACHE_EVICTION == S3FIFO) {
+      p->small = (struct page_fifo) { .pages = calloc(max_pages, sizeof(uint32_t)), .size = max_pages };
+      p->main = (struct page_fifo) { .pages = calloc(max_pages, sizeof(uint32_t)), .size = max_pages };
+      init_ghosts(&p->s3fifo_ghosts, p->target_pages - p->target_pages * S3FIFO_SMALL_RATIO / 100); // as many ghosts as pages in the main FIFO
+   }
+   if(PAGECACHE_ADMISSION) {
+      size_t width = 1;
+      while(width < SKETCH_WIDTH_PER_PAGE * p->target_pages) // with narrower rows the ADMISSION_SAMPLE accesses between two agings saturate the counters
+         width *= 2;
+      p->sketch = calloc(SKETCH_DEPTH * width / 2, sizeof(*p->sketch));
+      p->sketch_mask = width - 1;
+      p->sketch_additions = 0;
+      for(size_t i = 0; i < p->nb_transient_pages; i++)
+         p->used_pages[max_pages + i].page = PAGECACHE_GOVERNOR?get_frame():&p->cached_data[PAGE_SIZE*(max_pages + i)];
+      p->nb_transient_used = 0;
+      p->transient_next = 0;
+   }
+   if(PAGECACHE_RELEASES_FRAMES) {
+      p->frameless = calloc(max_pages, sizeof(*p->frameless));
+      p->nb_frameless = 0;
+   }
+   if(PAGECACHE_GOVERNOR) {
+      init_ghosts(&p->shadow, fair_share * GOVERNOR_SHADOW / 100);
+      p->nb_shadow_hits = 0;
+      p->last_shadow_hits = 0;
+   }
+   if(PAGECACHE_SCAN_RESISTANT)
+      init_ghosts(&p->scan_ghosts, fair_share * SCAN_GHOSTS / 100 + 1);
+   p->nb_hits = 0;
+   p->nb_misses = 0;
+   p->nb_rejected = 0;
+   if(PAGECACHE_COMPRESSED_SIZE)
+      p->zcache = zcache_init(PAGECACHE_COMPRESSED_SIZE/get_nb_workers());
 }
 
-struct lru *add_page_in_lru(struct pagecache *p, void *page, uint64_t hash) {
-   struct lru *me = &p->used_pages[p->used_page_size];
-   me->hash = hash;
-   me->page = page;
+void add_page_in_lru(struct pagecache *p, struct lru *me) {
    if(!p->oldest_page)
       p->oldest_page = me;
    me->prev = NULL;
@@ -46,7 +243,27 @@ struct lru *add_page_in_lru(struct pagecache *p, void *page, uint64_t hash) {
    if(p->newest_page)
       p->newest_page->prev = me;
    p->newest_page = me;
-   return me;
+}
+
+static void add_page_in_lru_oldest(struct pagecache *p, struct lru *me) {
+   if(!p->newest_page)
+      p->newest_page = me;
+   me->next = NULL;
+   me->prev = p->oldest_page;
+   if(p->oldest_page)
+      p->oldest_page->next = me;
+   p->oldest_page = me;
+}
+
+static void remove_page_from_lru(struct pagecache *p, struct lru *me) {
+   if(me->prev)
+      me->prev->next = me->next;
+   else
+      p->newest_page = me->next;
+   if(me->next)
+      me->next->prev = me->prev;
+   else
+      p->oldest_page = me->prev;
 }
 
 void bump_page_in_lru(struct pagecache *p, struct lru *me, uint64_t hash) {
@@ -65,17 +282,436 @@ void bump_page_in_lru(struct pagecache *p, struct lru *me, uint64_t hash) {
    p->newest_page = me;
 }
 
+/*
+ * A page that is being read or written cannot be reused, otherwise the IO would be done from / to the wrong page.
+ */
+static int page_is_busy(struct lru *me) {
+   return me->nb_reads || me->dirty || me->writing || me->nb_unflushed || me->modified;
+}
+
+static size_t page_idx(struct pagecache *p, struct lru *me) {
+   return me - p->used_pages;
+}
+
+/*
+ * S3FIFO
+ */
+static void fifo_push(struct page_fifo *f, size_t idx) {
+   assert(f->len < f->size);
+   f->pages[(f->head + f->len) % f->size] = idx;
+   f->len++;
+}
+
+static size_t fifo_pop(struct page_fifo *f) {
+   size_t idx = f->pages[f->head];
+   f->head = (f->head + 1) % f->size;
+   f->len--;
+   return idx;
+}
+
+static void add_ghost(struct ghosts *g, uint64_t hash) {
+   size_t slot = g->nb % g->size;
+   if(g->nb >= g->size) { // forget the oldest ghost, unless its hash has become a ghost again since
+      uint64_t old_hash = g->hashes[slot];
+      struct index_entry *e = hashtable_lookup(g->index, old_hash);
+      if(e && e->slab_idx == g->nb - g->size)
+         hashtable_delete(g->index, old_hash);
+   }
+   struct index_entry e = { .slab_idx = g->nb };
+   g->hashes[slot] = hash;
+   hashtable_insert(g->index, hash, &e);
+   g->nb++;
+}
+
+static int take_ghost(struct ghosts *g, uint64_t hash) {
+   if(!hashtable_lookup(g->index, hash))
+      return 0;
+   hashtable_delete(g->index, hash);
+   return 1;
+}
+
+static struct lru *s3fifo_evict(struct pagecache *p) {
+   size_t small_target = p->target_pages * S3FIFO_SMALL_RATIO / 100;
+   size_t busy_small = 0, busy_main = 0; // busy pages that went back in the FIFOs, stop when a FIFO only contains busy pages
+   while(1) {
+      int small_ok = busy_small < p->small.len, main_ok = busy_main < p->main.len;
+      if(!small_ok && !main_ok)
+         return NULL;
+      if(small_ok && (p->small.len > small_target || !main_ok)) {
+         size_t idx = fifo_pop(&p->small);
+         if(p->freq[idx]) {
+            p->freq[idx] = 0;
+            fifo_push(&p->main, idx);
+         } else if(page_is_busy(&p->used_pages[idx])) {
+            fifo_push(&p->small, idx);
+            busy_small++;
+         } else {
+            add_ghost(&p->s3fifo_ghosts, p->used_pages[idx].hash);
+            return &p->used_pages[idx];
+         }
+      } else {
+         size_t idx = fifo_pop(&p->main);
+         if(p->freq[idx]) {
+            p->freq[idx]--;
+            fifo_push(&p->main, idx);
+         } else if(page_is_busy(&p->used_pages[idx])) {
+            fifo_push(&p->main, idx);
+            busy_main++;
+         } else {
+            return &p->used_pages[idx];
+         }
+      }
+   }
+}
+
+/*
+ * CLOCK
+ */
+static struct lru *clock_evict(struct pagecache *p) {
+   for(size_t i = 0; i < 2*p->used_page_size; i++) {
+      size_t idx = p->hand;
+      p->hand = (p->hand + 1) % p->used_page_size;
+      if(p->freq[idx]) {
+         p->freq[idx] = 0;
+         continue;
+      }
+      if(p->used_pages[idx].page && !page_is_busy(&p->used_pages[idx])) // pages without frame are skipped (PAGECACHE_RELEASES_FRAMES)
+         return &p->used_pages[idx];
+   }
+   return NULL;
+}
+
+/*
+ * LRU
+ */
+static struct lru *lru_evict(struct pagecache *p) {
+   struct lru *lru_entry = p->oldest_page;
+   while(lru_entry && page_is_busy(lru_entry))
+      lru_entry = lru_entry->prev;
+   return lru_entry;
+}
+
+/*
+ * TinyLFU admission
+ */
+static uint64_t sketch_hash(uint64_t hash) { // hashes are (fd << 40) + page_num, mix the bits before using them as indexes
+   hash ^= hash >> 33;
+   hash *= 0xff51afd7ed558ccdLU;
+   hash ^= hash >> 33;
+   return hash;
+}
+
+/* Index of the counter of hash in row i; the rows use different combinations of the two halves of the mixed hash */
+static size_t sketch_counter(struct pagecache *p, uint64_t h, size_t i) {
+   uint64_t step = (h >> 32) | 1;
+   return i * (p->sketch_mask + 1) + ((h + i * step) & p->sketch_mask);
+}
+
+/* Counter c is in the low (even c) or high (odd c) 4 bits of byte c/2 */
+static size_t sketch_get(struct pagecache *p, size_t c) {
+   return (p->sketch[c / 2] >> (4 * (c & 1))) & 0xf;
+}
+
+static void sketch_add(struct pagecache *p, uint64_t hash) {
+   uint64_t h = sketch_hash(hash);
+   for(size_t i = 0; i < SKETCH_DEPTH; i++) {
+      size_t c = sketch_counter(p, h, i);
+      if(sketch_get(p, c) < SKETCH_MAX_COUNT)
+         p->sketch[c / 2] += 1 << (4 * (c & 1));
+   }
+   // Aging: halve everything, old accesses count less and less
+   if(++p->sketch_additions >= ADMISSION_SAMPLE * p->target_pages) {
+      for(size_t i = 0; i < SKETCH_DEPTH * (p->sketch_mask + 1) / 2; i++)
+         p->sketch[i] = (p->sketch[i] >> 1) & 0x77; // both counters of the byte, without the low bit of the high one moving to the low one
+      p->sketch_additions /= 2;
+   }
+}
+
+static size_t sketch_estimate(struct pagecache *p, uint64_t hash) {
+   uint64_t h = sketch_hash(hash);
+   size_t min = SKETCH_MAX_COUNT;
+   for(size_t i = 0; i < SKETCH_DEPTH; i++) {
+      size_t c = sketch_get(p, sketch_counter(p, h, i));
+      if(c < min)
+         min = c;
+   }
+   return min;
+}
+
+/* Next transient page that isn't busy, NULL if they all are. *was_used is set if the page already contains another hash. */
+static struct lru *transient_page(struct pagecache *p, int *was_used) {
+   for(size_t i = 0; i < p->nb_transient_pages; i++) {
+      size_t idx = p->transient_next;
+      struct lru *me = &p->used_pages[p->max_pages + idx];
+      p->transient_next = (p->transient_next + 1) % p->nb_transient_pages;
+      if(idx >= p->nb_transient_used) {
+         p->nb_transient_used++;
+         *was_used = 0;
+         return me;
+      }
+      if(!page_is_busy(me)) {
+         *was_used = 1;
+         return me;
+      }
+   }
+   return NULL;
+}
+
+static int scan_access(enum access_hint hint) {
+   return PAGECACHE_SCAN_RESISTANT && hint == ACCESS_SCAN;
+}
+
+static void page_hit(struct pagecache *p, struct lru *me, uint64_t hash, enum access_hint hint) {
+   if(page_idx(p, me) >= p->max_pages) // transient page, not managed by the eviction policy
+      return;
+   if(scan_access(hint)) // scans don't promote, even a page they read twice (2 items of the same page)
+      return;
+   if(PAGECACHE_EVICTION == LRU)
+      bump_page_in_lru(p, me, hash);
+   else if(PAGECACHE_EVICTION == CLOCK)
+      p->freq[page_idx(p, me)] = 1;
+   else if(p->freq[page_idx(p, me)] < 3)
+      p->freq[page_idx(p, me)]++;
+}
+
+/* A page of the cache now contains hash; reused is set if the page was evicted from the cache */
+static void page_inserted(struct pagecache *p, struct lru *me, uint64_t hash, int reused, enum access_hint hint) {
+   if(PAGECACHE_EVICTION == LRU) {
+      if(reused)
+         remove_page_from_lru(p, me);
+      if(scan_access(hint))
+         add_page_in_lru_oldest(p, me);
+      else
+         add_page_in_lru(p, me);
+   } else if(PAGECACHE_EVICTION == S3FIFO) {
+      p->freq[page_idx(p, me)] = 0;
+      if(!scan_access(hint) && take_ghost(&p->s3fifo_ghosts, hash))
+         fifo_push(&p->main, page_idx(p, me));
+      else
+         fifo_push(&p->small, page_idx(p, me));
+   } else {
+      p->freq[page_idx(p, me)] = 0;
+      if(scan_access(hint) && reused) // the hand has just passed the page, put it back under the hand
+         p->hand = page_idx(p, me);
+   }
+}
+
+static struct lru *evict_page(struct pagecache *p) {
+   if(PAGECACHE_EVICTION == LRU)
+      return lru_evict(p);
+   else if(PAGECACHE_EVICTION == CLOCK)
+      return clock_evict(p);
+   else
+      return s3fifo_evict(p);
+}
+
+/* The page is leaving the cache, keep a compressed copy if its content is complete (pages of sector IO slabs may be partially read) */
+static void page_evicted(struct pagecache *p, struct lru *me) {
+   if(p->zcache && me->contains_data)
+      zcache_put(p->zcache, me->hash, me->page);
+}
+
+/* A page with a frame that isn't used yet, if the cache is below its target size; NULL otherwise */
+static struct lru *new_page(struct pagecache *p) {
+   if(p->nb_pages >= p->target_pages)
+      return NULL;
+   size_t idx = p->nb_frameless?p->frameless[p->nb_frameless - 1]:p->used_page_size;
+   if(idx >= p->max_pages)
+      return NULL;
+   void *frame = PAGECACHE_GOVERNOR?get_frame():&p->cached_data[PAGE_SIZE*idx];
+   if(!frame) // the frames haven't been released by the other workers yet
+      return NULL;
+   if(p->nb_frameless)
+      p->nb_frameless--;
+   else
+      p->used_page_size++;
+   p->nb_pages++;
+   p->used_pages[idx].page = frame;
+   return &p->used_pages[idx];
+}
+
+/* PAGECACHE_RESIZE: give the memory of a frame back to the kernel; if it cannot be, the frame just stays in memory */
+static void trim_frame(void *frame) {
+   static int warned;
+   if(madvise(frame, PAGE_SIZE, MADV_DONTNEED) && !__atomic_exchange_n(&warned, 1, __ATOMIC_RELAXED))
+      printf("#WARNING! Cannot give the frames of the page cache back to the kernel (%s), the page cache shrinks but its memory stays in use\n", strerror(errno));
+}
+
+/* PAGECACHE_RESIZE: take up to max of the frames that p must give back to the kernel, @return how many were taken */
+static size_t take_frames_to_trim(struct pagecache *p, size_t max) {
+   size_t nb = __atomic_load_n(&p->frames_to_trim, __ATOMIC_RELAXED), taken;
+   do {
+      taken = (nb < max)?nb:max;
+   } while(!__atomic_compare_exchange_n(&p->frames_to_trim, &nb, nb - taken, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+   return taken;
+}
+
+/*
+ * PAGECACHE_RELEASES_FRAMES: give frames back until the cache is at its target size, to the pool (PAGECACHE_GOVERNOR) and to the kernel
+ * (PAGECACHE_RESIZE). Called by the worker when it isn't using any page. Busy pages are not evicted, the frames are released in later calls then.
+ */
+void page_cache_release_frames(struct pagecache *p) {
+   while(p->nb_pages > __atomic_load_n(&p->target_pages, __ATOMIC_RELAXED)) {
+      pagecache_entry_t *old_entry = NULL;
+      struct lru *me = evict_page(p);
+      if(!me)
+         return;
+      page_evicted(p, me);
+      tree_delete(p->hash_to_page, me->hash, &old_entry);
+      free(old_entry); // RAX and ART allocate the entries of the index
+      if(PAGECACHE_EVICTION == LRU)
+         remove_page_from_lru(p, me);
+      p->freq[page_idx(p, me)] = 0; // S3FIFO: evict_page already removed the page from its FIFO
+      int trimmed = PAGECACHE_RESIZE && take_frames_to_trim(p, 1);
+      if(trimmed)
+         trim_frame(me->page);
+      if(PAGECACHE_GOVERNOR) { // without governor the frame stays the frame of this entry of used_pages, see new_page
+         add_ghost(&p->shadow, me->hash);
+         put_frame(me->page, trimmed);
+      }
+      me->page = NULL;
+      me->contains_data = 0;
+      me->valid_sectors = 0;
+      p->frameless[p->nb_frameless++] = page_idx(p, me);
+      p->nb_pages--;
+   }
+}
+
+/*
+ * PAGECACHE_GOVERNOR: move GOVERNOR_STEP % of a fair share from the cache with the fewest shadow hits since the last call to the cache with the most.
+ * The shadow hits of a cache are the misses on the pages it evicted last, i.e., the hits that the next pages given to the cache would get;
+ * the fewest shadow hits is the cache that loses least by giving its last pages.
+ */
+void page_cache_rebalance(struct pagecache **caches, size_t nb_caches) {
+   size_t fair_share = MAX_PAGE_CACHE/nb_caches;
+   size_t step = fair_share * GOVERNOR_STEP / 100;
+   size_t min_pages = fair_share * GOVERNOR_MIN_SHARE / 100;
+   struct pagecache *donor = NULL, *receiver = NULL;
+   size_t donor_gain = 0, receiver_gain = 0;
+   if(!step)
+      step = 1;
+
+   for(size_t i = 0; i < nb_caches; i++) {
+      struct pagecache *p = caches[i];
+      size_t hits = __atomic_load_n(&p->nb_shadow_hits, __ATOMIC_RELAXED);
+      size_t gain = hits - p->last_shadow_hits;
+      p->last_shadow_hits = hits;
+      if(p->target_pages + step <= p->max_pages && (!receiver || gain > receiver_gain)) {
+         receiver = p;
+         receiver_gain = gain;
+      }
+      if(p->target_pages >= min_pages + step && (!donor || gain < donor_gain)) {
+         donor = p;
+         donor_gain = gain;
+      }
+   }
+
+   // Only move frames for a clear difference, not for noise
+   if(!donor || !receiver || donor == receiver || receiver_gain <= 2*donor_gain + 10)
+      return;
+   __atomic_sub_fetch(&donor->target_pages, step, __ATOMIC_RELAXED); // atomic, PAGECACHE_RESIZE changes the targets too
+   __atomic_add_fetch(&receiver->target_pages, step, __ATOMIC_RELAXED);
+   if(PAGECACHE_RESIZE) // the receiver keeps frames it had to give back to the kernel, the donor gives back as many more
+      __atomic_add_fetch(&donor->frames_to_trim, take_frames_to_trim(receiver, step), __ATOMIC_RELAXED);
+}
+
+/*
+ * PAGECACHE_RESIZE: shrink (grow = 0) or grow the page caches by RESIZE_STEP % of PAGE_CACHE_SIZE, split evenly between the caches.
+ * A cache keeps at least RESIZE_MIN_SHARE % of its fair share and the caches together never have more than their initial size.
+ * Caches that haven't filled their target yet first shrink to the pages they use, otherwise shrinking wouldn't free anything.
+ * @return the new size of all the caches, in pages
+ */
+size_t page_cache_resize(struct pagecache **caches, size_t nb_caches, int grow) {
+   size_t fair_share = MAX_PAGE_CACHE/nb_caches;
+   size_t step = MAX_PAGE_CACHE * RESIZE_STEP / 100 / nb_caches;
+   size_t min_pages = fair_share * RESIZE_MIN_SHARE / 100;
+   size_t total = 0, max_total = 0;
+   if(!step)
+      step = 1;
+   for(size_t i = 0; i < nb_caches; i++) {
+      total += __atomic_load_n(&caches[i]->target_pages, __ATOMIC_RELAXED);
+      max_total += fair_share - caches[i]->nb_transient_pages;
+   }
+
+   for(size_t i = 0; i < nb_caches; i++) {
+      struct pagecache *p = caches[i];
+      size_t target = __atomic_load_n(&p->target_pages, __ATOMIC_RELAXED);
+      if(grow) {
+         size_t more = step;
+         if(target + more > p->max_pages)
+            more = p->max_pages - target;
+         if(total + more > max_total)
+            more = (total < max_total)?(max_total - total):0;
+         __atomic_add_fetch(&p->target_pages, more, __ATOMIC_RELAXED);
+         total += more;
+         take_frames_to_trim(p, more); // frames that haven't been released yet don't have to be
+      } else {
+         size_t used = __atomic_load_n(&p->nb_pages, __ATOMIC_RELAXED);
+         size_t less = ((target > used)?(target - used):0) + step;
+         if(target < min_pages + less)
+            less = (target > min_pages)?(target - min_pages):0;
+         __atomic_sub_fetch(&p->target_pages, less, __ATOMIC_RELAXED);
+         if(used > target - less) { // pages that will leave the cache because of this step, p gives their frames back to the kernel when it releases them
+            size_t leaving = used - (target - less);
+            __atomic_add_fetch(&p->frames_to_trim, (leaving < less)?leaving:less, __ATOMIC_RELAXED);
+         }
+         total -= less;
+      }
+   }
+   return total;
+}
+
+/*
+ * WARMUP: the hashes of the pages that contain data, at most max. Called by another thread than the worker of the page cache,
+ * the pages may change while they are listed: the result is only a hint.
+ */
+size_t page_cache_cached_pages(struct pagecache *p, uint64_t *hashes, size_t max) {
+   size_t nb = 0, used = *(volatile size_t*)&p->used_page_size;
+   for(size_t i = 0; i < used && nb < max; i++) {
+      struct lru *me = &p->used_pages[i];
+      if(*(volatile int*)&me->contains_data)
+         hashes[nb++] = *(volatile uint64_t*)&me->hash;
+   }
+   return nb;
+}
+
+/*
+ * Pages in the order in which the eviction policy will look at them (used by the write back flusher to write pages before they have to be evicted).
+ * Start with *cursor = 0. @return NULL after the last page.
+ */
+struct lru *eviction_candidate(struct pagecache *p, size_t *cursor) {
+   size_t i = (*cursor)++;
+   if(PAGECACHE_EVICTION == LRU) { // *cursor is the index of the last page returned + 1
+      struct lru *me = i?p->used_pages[i - 1].prev:p->oldest_page;
+      if(me)
+         *cursor = page_idx(p, me) + 1;
+      return me;
+   } else if(PAGECACHE_EVICTION == CLOCK) {
+      return (i < p->used_page_size)?&p->used_pages[(p->hand + i) % p->used_page_size]:NULL;
+   } else {
+      if(i < p->small.len)
+         return &p->used_pages[p->small.pages[(p->small.head + i) % p->small.size]];
+      i -= p->small.len;
+      if(i < p->main.len)
+         return &p->used_pages[p->main.pages[(p->main.head + i) % p->main.size]];
+      return NULL;
+   }
+}
+
 /*
  * Get a page from the page cache.
  * *page will be set to the address in the page cache
- * @return 1 if the page already contains the right data, 0 otherwise.
+ * @return 1 if the page already contains the right data (it was cached, or it was in the compressed tier), 0 otherwise.
  */
-int get_page(struct pagecache *p, uint64_t hash, void **page, struct lru **lru) {
+int get_page(struct pagecache *p, uint64_t hash, enum access_hint hint, void **page, struct lru **lru) {
    void *dst;
    struct lru *lru_entry;
    maybe_unused pagecache_entry_t tmp_entry;
    maybe_unused pagecache_entry_t *old_entry = NULL;
 
+   if(PAGECACHE_ADMISSION)
+      sketch_add(p, hash);
+
    // Is the page already cached?
    pagecache_entry_t *e = tree_lookup(p->hash_to_page, hash);
    if(e) {
@@ -83,36 +719,108 @@ int get_page(struct pagecache *p, uint64_t hash, void **page, struct lru **lru)
       lru_entry = e->lru;
       if(lru_entry->hash != hash)
          die("LRU wierdness %lu vs %lu\n", lru_entry->hash, hash);
-      bump_page_in_lru(p, lru_entry, hash);
+      page_hit(p, lru_entry, hash, hint);
+      p->nb_hits++;
       *page = dst;
       *lru = lru_entry;
       return 1;
    }
+   p->nb_misses++;
+   if(PAGECACHE_GOVERNOR && take_ghost(&p->shadow, hash))
+      p->nb_shadow_hits++;
+   if(scan_access(hint)) { // a page scanned again while it is remembered isn't read once, insert it like the page of a point read
+      if(take_ghost(&p->scan_ghosts, hash))
+         hint = ACCESS_NORMAL;
+      else
+         add_ghost(&p->scan_ghosts, hash);
+   }
 
 
-   // Otherwise allocate a new page, either a free one, or reuse the oldest
-   if(p->used_page_size < MAX_PAGE_CACHE/get_nb_workers()) {
-      dst = &p->cached_data[PAGE_SIZE*p->used_page_size];
-      lru_entry = add_page_in_lru(p, dst, hash);
-      p->used_page_size++;
+   // Otherwise allocate a new page, either a free one, or evict one
+   lru_entry = new_page(p);
+   if(lru_entry) {
+      dst = lru_entry->page;
+      lru_entry->hash = hash;
+      page_inserted(p, lru_entry, hash, 0, hint);
    } else {
-      lru_entry = p->oldest_page;
-      dst = p->oldest_page->page;
+      lru_entry = evict_page(p);
+      if(!lru_entry)
+         die("All pages of the page cache have pending IOs, the page cache is too small!\n");
+
+      // Not hotter than the victim, or read by a scan: keep the victim and use a transient page (unless they are all busy)
+      int transient = 0, was_used = 1;
+      if(PAGECACHE_ADMISSION && (scan_access(hint) || sketch_estimate(p, hash) <= sketch_estimate(p, lru_entry->hash))) {
+         struct lru *transient_entry = transient_page(p, &was_used);
+         if(transient_entry) {
+            lru_entry = transient_entry;
+            transient = 1;
+            p->nb_rejected++;
+         }
+      }
+      dst = lru_entry->page;
 
-      tree_delete(p->hash_to_page, p->oldest_page->hash, &old_entry);
+      if(was_used) {
+         page_evicted(p, lru_entry);
+         tree_delete(p->hash_to_page, lru_entry->hash, &old_entry);
+      }
+      if(PAGECACHE_GOVERNOR && !transient)
+         add_ghost(&p->shadow, lru_entry->hash);
 
       lru_entry->hash = hash;
       lru_entry->page = dst;
-      bump_page_in_lru(p, lru_entry, hash);
+      if(!transient)
+         page_inserted(p, lru_entry, hash, 1, hint);
    }
 
    // Remember that the page cache now stores this hash
    tree_insert(p->hash_to_page, hash, old_entry, dst, lru_entry);
 
    lru_entry->contains_data = 0;
+   lru_entry->valid_sectors = 0;
+   lru_entry->reading_sectors = 0;
    lru_entry->dirty = 0; // should already be equal to 0, but we never know
+   lru_entry->dirty_sectors = 0;
    *page = dst;
    *lru = lru_entry;
 
+   if(p->zcache && zcache_get(p->zcache, hash, dst)) {
+      lru_entry->contains_data = 1;
+      lru_entry->valid_sectors = ALL_SECTORS;
+      return 1;
+   }
    return 0;
 }
+
+/*
+ * Write back: modified pages are kept in a FIFO so that the flusher can write the oldest modifications first.
+ * A page is only added once, when it is first modified; modifying it again doesn't change its position.
+ */
+void mark_page_modified(struct pagecache *p, struct lru *me) {
+   if(me->modified)
+      return;
+   me->modified = 1;
+   rdtscll(me->modified_at);
+   me->modified_prev = p->newest_modified;
+   me->modified_next = NULL;
+   if(p->newest_modified)
+      p->newest_modified->modified_next = me;
+   else
+      p->oldest_modified = me;
+   p->newest_modified = me;
+   p->nb_modified_pages++;
+}
+
+void clear_page_modified(struct pagecache *p, struct lru *me) {
+   if(!me->modified)
+      return;
+   me->modified = 0;
+   if(me->modified_prev)
+      me->modified_prev->modified_next = me->modified_next;
+   else
+      p->oldest_modified = me->modified_next;
+   if(me->modified_next)
+      me->modified_next->modified_prev = me->modified_prev;
+   else
+      p->newest_modified = me->modified_prev;
+   p->nb_modified_pages--;
+}
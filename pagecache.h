@@ -3,11 +3,13 @@
 
 typedef struct index_entry pagecache_entry_t;
 
+#include "indexes/hashtable.h"
+
 #if PAGECACHE_INDEX == RBTREE
 
 #include "indexes/rbtree.h"
 typedef rbtree hash_t;
-#define tree_create() rbtree_create()
+#define tree_create(nb_entries) rbtree_create()
 #define tree_lookup(h, hash) rbtree_lookup((h), (void*)(hash), pointer_cmp)
 #define tree_delete(h, hash, old_entry)  rbtree_delete((h), (void*)(hash), pointer_cmp);
 #define tree_insert(h, hash, old_entry, dst, lru_entry) \
@@ -20,7 +22,7 @@ typedef rbtree hash_t;
 
 #include "indexes/rax.h"
 typedef rax* hash_t;
-#define tree_create() raxNew()
+#define tree_create(nb_entries) raxNew()
 #define tree_lookup(h, hash) ({ void *__v = raxFind((h), (unsigned char*)&(hash), sizeof(hash)); __v==raxNotFound?NULL:__v; })
 #define tree_delete(h, hash, old_entry) raxRemove((h), (unsigned char *)&(hash), sizeof(hash), (void**)(old_entry))
 #define tree_insert(h, hash, old_entry, dst, lru_entry) \
@@ -37,7 +39,7 @@ typedef rax* hash_t;
 
 #include "indexes/art.h"
 typedef art_tree* hash_t;
-#define tree_create() ({ art_tree *___t = malloc(sizeof(*___t)); art_tree_init(___t); ___t; })
+#define tree_create(nb_entries) ({ art_tree *___t = malloc(sizeof(*___t)); art_tree_init(___t); ___t; })
 #define tree_lookup(h, hash) art_search((h), (unsigned char*)&(hash), sizeof(hash))
 #define tree_delete(h, hash, old_entry) *old_entry = art_delete((h), (unsigned char *)&(hash), sizeof(hash))
 #define tree_insert(h, hash, old_entry, dst, lru_entry) \
@@ -54,7 +56,7 @@ typedef art_tree* hash_t;
 
 #include "indexes/btree.h"
 typedef btree_t* hash_t;
-#define tree_create() btree_create()
+#define tree_create(nb_entries) btree_create()
 #define tree_lookup(h, hash) ({ int res = btree_find((h), (unsigned char*)&(hash), sizeof(hash), &tmp_entry); res?&tmp_entry:NULL; })
 #define tree_delete(h, hash, old_entry) \
    do { \
@@ -66,27 +68,98 @@ typedef btree_t* hash_t;
       btree_insert((h),(unsigned char*)&(hash),sizeof(hash), &new_entry); \
    } while(0)
 
+#elif PAGECACHE_INDEX == HASHTABLE
+
+#include "indexes/hashtable.h"
+typedef hashtable_t* hash_t;
+#define tree_create(nb_entries) hashtable_create(nb_entries)
+#define tree_lookup(h, hash) hashtable_lookup((h), (hash))
+#define tree_delete(h, hash, old_entry) hashtable_delete((h), (hash))
+#define tree_insert(h, hash, old_entry, dst, lru_entry) \
+   do { \
+      pagecache_entry_t new_entry = { .page = dst, .lru = lru_entry }; \
+      hashtable_insert((h), (hash), &new_entry); \
+   } while(0)
 
 #endif
 
 
+#define PAGECACHE_RELEASES_FRAMES (PAGECACHE_GOVERNOR || PAGECACHE_RESIZE) // target_pages changes at run time, the workers give frames back with page_cache_release_frames
+
+#define SECTORS_PER_PAGE (PAGE_SIZE / SECTOR_SIZE)
+#define ALL_SECTORS ((1LU << SECTORS_PER_PAGE) - 1)
+
 struct lru {
    struct lru *prev;
    struct lru *next;
    uint64_t hash;
    void *page;
-   int contains_data;
+   int contains_data; // valid_sectors == ALL_SECTORS
+   uint64_t valid_sectors; // bitmap of the sectors that contain the correct content
+   uint64_t reading_sectors; // bitmap of the sectors being read
+   int nb_reads; // reads of the page in flight
    int dirty;
+   uint64_t dirty_sectors; // bitmap of the sectors that the next write of the page must write
+   int writing;
+   uint64_t write_gen; // Number of writes of the page that completed (and are durable, see DURABILITY)
+   int nb_unflushed; // DURABILITY_GROUP_FLUSH: writes of the page that completed but wait for a fdatasync
+   struct linked_callbacks *waiters; // callbacks waiting for a read or a write of the page in flight, see ioengine.c
+   int modified; // WRITE_BACK: the page has been updated in memory but the flusher hasn't sent it to disk yet
+   uint64_t modified_at;
+   struct lru *modified_prev, *modified_next;
+};
+
+/* A FIFO of page indexes (S3FIFO) */
+struct page_fifo {
+   uint32_t *pages;
+   size_t head, len, size;
+};
+
+/* The hashes of the last size pages evicted (S3FIFO, PAGECACHE_GOVERNOR); hash -> number of the ghost (slab_idx field), ghost n is hashes[n % size] */
+struct ghosts {
+   uint64_t *hashes;
+   hashtable_t *index;
+   size_t size, nb;
 };
 
 struct pagecache {
-   char *cached_data;
+   char *cached_data; // the frames of the pages; with PAGECACHE_GOVERNOR, the memory of all the page caches
+   size_t cached_data_size;
    hash_t hash_to_page;
-   struct lru *used_pages, *oldest_page, *newest_page;
-   size_t used_page_size;
+   struct lru *used_pages, *oldest_page, *newest_page; // oldest_page and newest_page are only used by LRU eviction
+   size_t used_page_size; // used_pages[0..used_page_size[ have been used, some of them may have given their frame back (PAGECACHE_GOVERNOR, PAGECACHE_RESIZE)
+   size_t max_pages; // entries of used_pages managed by the eviction policy, the transient pages come after
+   size_t nb_pages, target_pages; // pages (with a frame) managed by the eviction policy, and how many it should have (changed by the governor)
+   size_t frames_to_trim; // PAGECACHE_RESIZE: frames by which resizing shrank this cache that haven't been given back to the kernel yet
+   uint32_t *frameless; // PAGECACHE_GOVERNOR, PAGECACHE_RESIZE: entries of used_pages whose frame went to another worker or back to the kernel
+   size_t nb_frameless;
+   uint8_t *freq; // CLOCK: reference bit of each page; S3FIFO: number of hits (max 3); indexed like used_pages
+   size_t hand; // CLOCK: next page looked at by the hand
+   struct page_fifo small, main; // S3FIFO
+   struct ghosts s3fifo_ghosts; // S3FIFO: pages evicted from the small FIFO
+   struct ghosts shadow; // PAGECACHE_GOVERNOR: pages evicted, a miss on one of them would have been a hit with a bigger cache
+   size_t nb_shadow_hits, last_shadow_hits;
+   struct ghosts scan_ghosts; // PAGECACHE_SCAN_RESISTANT: pages inserted by the last scans
+   uint8_t *sketch; // PAGECACHE_ADMISSION: count-min sketch of the accesses, SKETCH_DEPTH rows of sketch_mask + 1 4-bit counters, 2 per byte
+   size_t sketch_mask, sketch_additions;
+   size_t nb_transient_pages, nb_transient_used, transient_next; // PAGECACHE_ADMISSION: the transient pages are the last pages of the cache, used in FIFO order
+   size_t nb_hits, nb_misses, nb_rejected;
+   struct lru *oldest_modified, *newest_modified; // WRITE_BACK: modified pages, in order of first modification
+   size_t nb_modified_pages;
+   struct zcache *zcache; // PAGECACHE_COMPRESSED_SIZE: compressed copies of the pages evicted last
 };
 
+/* How a page is accessed: pages of scans are only read once, they shouldn't push the pages of point reads out (PAGECACHE_SCAN_RESISTANT) */
+enum access_hint { ACCESS_NORMAL, ACCESS_SCAN };
+
 void page_cache_init(struct pagecache *p);
-int get_page(struct pagecache *p, uint64_t hash, void **page, struct lru **lru);
+int get_page(struct pagecache *p, uint64_t hash, enum access_hint hint, void **page, struct lru **lru);
+struct lru *eviction_candidate(struct pagecache *p, size_t *cursor);
+void page_cache_release_frames(struct pagecache *p);
+void page_cache_rebalance(struct pagecache **caches, size_t nb_caches);
+size_t page_cache_resize(struct pagecache **caches, size_t nb_caches, int grow);
+size_t page_cache_cached_pages(struct pagecache *p, uint64_t *hashes, size_t max);
+void mark_page_modified(struct pagecache *p, struct lru *me);
+void clear_page_modified(struct pagecache *p, struct lru *me);
 
 #endif
@@ -0,0 +1,235 @@
+#include "headers.h"
+#include <getopt.h>
+
+/*
+ * Replay IO traces recorded with IO_TRACE (see iotrace.h) on a file or a device, without running KVell.
+ * Usage: ./replay [-f] [-q queue depth] -t <file or device> <trace files>
+ *
+ * The IOs of all the traces are merged and sent in the order they were submitted, using Linux AIO:
+ * - by default with their original timing (an IO is sent as long after the first IO as it was in the trace);
+ * - with -f as fast as possible, keeping at most -q IOs in flight.
+ *
+ * The files of the traced run are mapped one after the other in the target: the IOs to a file of the trace go to a region
+ * of the target as big as the largest offset written or read in the file. Writes write garbage, don't replay on a device that contains data!
+ * A file target is allocated but not written: the first writes to it are slower, replay twice to compare with the trace.
+ */
+#define REPLAY_MAX_QUEUE_DEPTH 1024
+#define REPLAY_MAX_IO_SIZE (MAX_COALESCED_PAGES*PAGE_SIZE)
+
+struct replay_io {
+   struct io_trace_record r;
+   uint64_t base;                // offset of the region of the traced file in the target
+};
+
+static int io_setup(unsigned nr, aio_context_t *ctxp) {
+	return syscall(__NR_io_setup, nr, ctxp);
+}
+
+static int io_submit(aio_context_t ctx, long nr, struct iocb **iocbpp) {
+	return syscall(__NR_io_submit, ctx, nr, iocbpp);
+}
+
+static int io_getevents(aio_context_t ctx, long min_nr, long max_nr,
+		struct io_event *events, struct timespec *timeout) {
+	return syscall(__NR_io_getevents, ctx, min_nr, max_nr, events, timeout);
+}
+
+/*
+ * Load the traces, all timestamps are converted to ns since the first IO of the run
+ */
+static struct replay_io *ios;
+static size_t nb_ios;
+
+static void load_trace(const char *path) {
+   struct io_trace_header header;
+   struct stat sb;
+   int fd = open(path, O_RDONLY);
+   if(fd == -1)
+      perr("Cannot open trace %s\n", path);
+   if(read(fd, &header, sizeof(header)) != sizeof(header) || header.magic != IO_TRACE_MAGIC || header.record_size != sizeof(struct io_trace_record))
+      die("%s is not a KVell IO trace\n", path);
+
+   fstat(fd, &sb);
+   size_t nb_records = (sb.st_size - sizeof(header)) / sizeof(struct io_trace_record);
+   struct io_trace_record *records = malloc(nb_records * sizeof(*records));
+   if(read(fd, records, nb_records * sizeof(*records)) != nb_records * sizeof(*records))
+      perr("Cannot read trace %s\n", path);
+   close(fd);
+
+   ios = realloc(ios, (nb_ios + nb_records) * sizeof(*ios));
+   for(size_t i = 0; i < nb_records; i++) {
+      struct replay_io *io = &ios[nb_ios++];
+      io->r = records[i];
+      io->r.submit = io->r.submit * 1000000000.0 / header.cycles_per_sec; // ns, rdtsc is the same on all cores
+      io->r.latency = io->r.latency * 1000000000.0 / header.cycles_per_sec;
+   }
+   free(records);
+   printf("# %s: worker %u, %lu IOs\n", path, header.worker_id, nb_records);
+}
+
+static int cmp_submit(const void *_a, const void *_b) {
+   const struct replay_io *a = _a, *b = _b;
+   if(a->r.submit != b->r.submit)
+      return (a->r.submit < b->r.submit)?-1:1;
+   return 0;
+}
+
+/* Give every traced file its own region of the target. @return the size of the target needed by the replay */
+static uint64_t map_files(void) {
+   uint64_t *file_size = calloc(UINT16_MAX + 1, sizeof(*file_size));
+   uint64_t *file_base = calloc(UINT16_MAX + 1, sizeof(*file_base));
+   for(size_t i = 0; i < nb_ios; i++) {
+      uint64_t end = ios[i].r.offset + ios[i].r.nbytes;
+      if(end > file_size[ios[i].r.fd])
+         file_size[ios[i].r.fd] = end;
+   }
+   uint64_t total = 0;
+   for(size_t f = 0; f <= UINT16_MAX; f++) {
+      file_base[f] = total;
+      total += (file_size[f] + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE;
+   }
+   for(size_t i = 0; i < nb_ios; i++)
+      ios[i].base = file_base[ios[i].r.fd];
+   free(file_size);
+   free(file_base);
+   return total;
+}
+
+static uint64_t now_ns(void) {
+   struct timespec t;
+   clock_gettime(CLOCK_MONOTONIC, &t);
+   return t.tv_sec * 1000000000LU + t.tv_nsec;
+}
+
+static int cmp_u64(const void *_a, const void *_b) {
+   uint64_t a = *(uint64_t*)_a, b = *(uint64_t*)_b;
+   return (a < b)?-1:(a > b);
+}
+
+static void print_latencies(const char *name, uint64_t *latencies, size_t nb) {
+   uint64_t total = 0;
+   for(size_t i = 0; i < nb; i++)
+      total += latencies[i];
+   qsort(latencies, nb, sizeof(*latencies), cmp_u64);
+   printf("#\t%s latency: avg %lu us, p50 %lu us, p99 %lu us, max %lu us\n", name,
+         total / nb / 1000, latencies[nb / 2] / 1000, latencies[nb * 99 / 100] / 1000, latencies[nb - 1] / 1000);
+}
+
+int main(int argc, char **argv) {
+   char *target = NULL;
+   int fast = 0;
+   size_t queue_depth = REPLAY_MAX_QUEUE_DEPTH;
+   int opt;
+   while((opt = getopt(argc, argv, "ft:q:")) != -1) {
+      switch(opt) {
+         case 'f':
+            fast = 1;
+            break;
+         case 't':
+            target = optarg;
+            break;
+         case 'q':
+            queue_depth = atoi(optarg);
+            break;
+         default:
+            target = NULL;
+            optind = argc;
+      }
+   }
+   if(!target || optind == argc || queue_depth == 0 || queue_depth > REPLAY_MAX_QUEUE_DEPTH)
+      die("Usage: ./replay [-f] [-q queue depth (max %d)] -t <file or device> <trace files>\n\t-f: replay as fast as possible instead of with the original timing", REPLAY_MAX_QUEUE_DEPTH);
+
+   for(int i = optind; i < argc; i++)
+      load_trace(argv[i]);
+   if(!nb_ios)
+      die("Empty traces\n");
+   qsort(ios, nb_ios, sizeof(*ios), cmp_submit);
+   uint64_t first_submit = ios[0].r.submit;
+   uint64_t size = map_files();
+
+   int fd = open(target, O_RDWR | O_CREAT | O_DIRECT, 0644);
+   if(fd == -1)
+      perr("Cannot open %s\n", target);
+   struct stat sb;
+   fstat(fd, &sb);
+   if(S_ISREG(sb.st_mode) && sb.st_size < size && fallocate(fd, 0, 0, size))
+      perr("Cannot allocate %lu bytes in %s\n", size, target);
+   printf("# Replaying %lu IOs on %s (%lu MB used) %s\n", nb_ios, target, size / 1024 / 1024, fast?"as fast as possible":"with the original timing");
+
+   aio_context_t ctx = 0;
+   if(io_setup(queue_depth, &ctx) < 0)
+      perr("Cannot create aio setup\n");
+   struct iocb *iocbs = calloc(queue_depth, sizeof(*iocbs));
+   struct iocb **free_iocbs = calloc(queue_depth, sizeof(*free_iocbs));
+   struct iocb **submitted = calloc(queue_depth, sizeof(*submitted));
+   struct io_event *events = calloc(queue_depth, sizeof(*events));
+   uint64_t *submit_time = calloc(queue_depth, sizeof(*submit_time));
+   size_t *io_idx = calloc(queue_depth, sizeof(*io_idx));
+   char *buffers = aligned_alloc(PAGE_SIZE, queue_depth * REPLAY_MAX_IO_SIZE);
+   memset(buffers, 0xa5, queue_depth * REPLAY_MAX_IO_SIZE);
+   size_t nb_free = 0;
+   for(size_t i = 0; i < queue_depth; i++)
+      free_iocbs[nb_free++] = &iocbs[i];
+
+   uint64_t *latencies = calloc(nb_ios, sizeof(*latencies));
+   uint64_t *original_latencies = calloc(nb_ios, sizeof(*original_latencies));
+   size_t next = 0, nb_completed = 0, nb_late = 0;
+
+   declare_timer;
+   start_timer {
+      uint64_t start = now_ns();
+      while(nb_completed < nb_ios) {
+         // Send all the IOs that are due
+         uint64_t now = now_ns();
+         size_t nb_submitted = 0;
+         while(next < nb_ios && nb_free && (fast || ios[next].r.submit - first_submit <= now - start)) {
+            struct replay_io *io = &ios[next];
+            struct iocb *cb = free_iocbs[--nb_free];
+            size_t idx = cb - iocbs;
+            memset(cb, 0, sizeof(*cb));
+            cb->aio_fildes = fd;
+            cb->aio_lio_opcode = io->r.opcode;
+            if(io->r.opcode != IOCB_CMD_FDSYNC) { // the kernel refuses syncs with a buffer
+               cb->aio_buf = (uint64_t)&buffers[idx * REPLAY_MAX_IO_SIZE];
+               cb->aio_offset = io->base + io->r.offset;
+               cb->aio_nbytes = (io->r.nbytes > REPLAY_MAX_IO_SIZE)?REPLAY_MAX_IO_SIZE:io->r.nbytes;
+            }
+            cb->aio_data = idx;
+            if(!fast && now - start > io->r.submit - first_submit + 1000000LU) // more than 1ms late, the target can't keep up
+               nb_late++;
+            submit_time[idx] = now;
+            io_idx[idx] = next;
+            submitted[nb_submitted++] = cb;
+            next++;
+         }
+         if(nb_submitted && io_submit(ctx, nb_submitted, submitted) != nb_submitted)
+            perr("Couldn't submit all io requests\n");
+
+         // Reap completions; only block when nothing else can be sent
+         int must_wait = (next == nb_ios || !nb_free || fast) && nb_free < queue_depth;
+         int ret = io_getevents(ctx, must_wait?1:0, queue_depth, events, NULL);
+         if(ret < 0)
+            perr("io_getevents failed\n");
+         now = now_ns();
+         for(size_t i = 0; i < ret; i++) {
+            size_t idx = events[i].data;
+            if(events[i].res < 0)
+               die("IO failed with %lld (offset %llu size %llu)\n", events[i].res, iocbs[idx].aio_offset, iocbs[idx].aio_nbytes);
+            latencies[nb_completed] = now - submit_time[idx];
+            original_latencies[nb_completed] = ios[io_idx[idx]].r.latency;
+            nb_completed++;
+            free_iocbs[nb_free++] = &iocbs[idx];
+         }
+         if(!ret && !nb_submitted && !fast)
+            NOP10();
+      }
+   } stop_timer("Replayed %lu IOs (%lu IO/s)", nb_ios, nb_ios*1000000LU/elapsed);
+
+   uint64_t traced_duration = (ios[nb_ios - 1].r.submit - first_submit) / 1000 + 1;
+   printf("#\tTraced run: %lu ms (%lu IO/s)\n", traced_duration / 1000, nb_ios * 1000000LU / traced_duration);
+   if(!fast)
+      printf("#\t%lu IOs were sent more than 1ms late, the target is slower than the traced drive\n", nb_late);
+   print_latencies("Traced", original_latencies, nb_ios);
+   print_latencies("Replay", latencies, nb_ios);
+   return 0;
+}
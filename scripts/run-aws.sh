@@ -17,10 +17,10 @@ mv ${mainDir}/main.c.tmp ${mainDir}/main.c
 make -C ${mainDir} -j
 
 echo "Run 1"
-${tcmalloc} ${mainDir}/main 8 4 | tee log_ycsb_1
+${tcmalloc} ${mainDir}/main 8 32 | tee log_ycsb_1
 
 echo "Run 2"
-${tcmalloc} ${mainDir}/main 8 4 | tee log_ycsb_2
+${tcmalloc} ${mainDir}/main 8 32 | tee log_ycsb_2
 
 mv ${mainDir}/main.c.bak ${mainDir}/main.c
 
@@ -36,10 +36,10 @@ cp ${mainDir}/main.c.tmp ${mainDir}/main.c
 make -C ${mainDir} -j
 
 echo "Run 1 (scans)"
-${tcmalloc} ${mainDir}/main 8 3 | tee log_ycsb_e_1
+${tcmalloc} ${mainDir}/main 8 24 | tee log_ycsb_e_1
 
 echo "Run 2 (scans)"
-${tcmalloc} ${mainDir}/main 8 3 | tee log_ycsb_e_2
+${tcmalloc} ${mainDir}/main 8 24 | tee log_ycsb_e_2
 
 mv ${mainDir}/main.c.bak ${mainDir}/main.c
 
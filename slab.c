@@ -16,6 +16,9 @@
  * That way, when we reuse an empty spot, we know where the next one is.
  *
  *
+ * A slab can be striped over STRIPE_WIDTH files, on different disks: page p of the slab is page p / STRIPE_WIDTH of file p % STRIPE_WIDTH.
+ * All files of a slab always have the same size.
+ *
  * This whole file assumes that when a file is newly created, then all the data is equal to 0. This should be true on Linux.
  */
 
@@ -26,11 +29,31 @@ off_t item_page_num(struct slab *s, size_t idx) {
    size_t items_per_page = PAGE_SIZE/s->item_size;
    return idx / items_per_page;
 }
+int slab_page_fd(struct slab *s, size_t page_num) {
+   return s->fds[page_num % STRIPE_WIDTH];
+}
+off_t slab_page_offset(struct slab *s, size_t page_num) {
+   return (page_num / STRIPE_WIDTH) * PAGE_SIZE;
+}
 static off_t item_in_page_offset(struct slab *s, size_t idx) {
    size_t items_per_page = PAGE_SIZE/s->item_size;
    return (idx % items_per_page)*s->item_size;
 }
 
+/*
+ * With sector IOs, only the sectors that contain the item are read / written (an item might span 2 sectors).
+ */
+static void item_sectors(struct slab *s, size_t idx, size_t *first_sector, size_t *nb_sectors) {
+   if(!s->sector_io) {
+      *first_sector = 0;
+      *nb_sectors = SECTORS_PER_PAGE;
+      return;
+   }
+   off_t offset = item_in_page_offset(s, idx);
+   *first_sector = offset / SECTOR_SIZE;
+   *nb_sectors = (offset + s->item_size - 1) / SECTOR_SIZE - *first_sector + 1;
+}
+
 /*
  * When first loading a slab from disk we need to rebuild the in memory tree, these functions do that.
  */
@@ -76,24 +99,26 @@ void process_existing_chunk(int slab_worker_id, struct slab *s, size_t nb_files,
 void rebuild_index(int slab_worker_id, struct slab *s, struct slab_callback *callback) {
    char *cached_data = aligned_alloc(PAGE_SIZE, GRANULARITY_REBUILD);
 
-   int fd = s->fd;
-   size_t start = 0, end;
-   while(1) {
-      end = start + GRANULARITY_REBUILD;
-      if(end > s->size_on_disk)
-         end = s->size_on_disk;
-      if( ((end - start) % PAGE_SIZE) != 0)
-         end = end - (end % PAGE_SIZE);
-      if( ((end - start) % PAGE_SIZE) != 0)
-         die("File size is wrong (%%PAGE_SIZE!=0)\n");
-      if(end == start)
-         break;
-      int r = pread(fd, cached_data, end - start, start);
-      if(r != end - start)
-         perr("pread failed! Read %d instead of %lu (offset %lu)\n", r, end-start, start);
-      process_existing_chunk(slab_worker_id, s, 1, 0, cached_data, start, end-start, callback);
-      start = end;
-
+   size_t file_size = s->size_on_disk / STRIPE_WIDTH;
+   for(size_t f = 0; f < STRIPE_WIDTH; f++) {
+      int fd = s->fds[f];
+      size_t start = 0, end;
+      while(1) {
+         end = start + GRANULARITY_REBUILD;
+         if(end > file_size)
+            end = file_size;
+         if( ((end - start) % PAGE_SIZE) != 0)
+            end = end - (end % PAGE_SIZE);
+         if( ((end - start) % PAGE_SIZE) != 0)
+            die("File size is wrong (%%PAGE_SIZE!=0)\n");
+         if(end == start)
+            break;
+         int r = pread(fd, cached_data, end - start, start);
+         if(r != end - start)
+            perr("pread failed! Read %d instead of %lu (offset %lu)\n", r, end-start, start);
+         process_existing_chunk(slab_worker_id, s, STRIPE_WIDTH, f, cached_data, start, end-start, callback);
+         start = end;
+      }
    }
    free(cached_data);
    s->last_item++;
@@ -107,22 +132,42 @@ void rebuild_index(int slab_worker_id, struct slab *s, struct slab_callback *cal
  * Create a slab: a file that only contains items of a given size.
  * @callback is a callback that will be called on all previously existing items of the slab if it is restored from disk.
  */
+/* Allocate size bytes of slab, spread over all the files of the slab */
+static int allocate_slab(struct slab *s, size_t size) {
+   size_t nb_pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+   size_t file_size = (nb_pages + STRIPE_WIDTH - 1) / STRIPE_WIDTH * PAGE_SIZE;
+   for(size_t f = 0; f < STRIPE_WIDTH; f++) {
+      if(fallocate(s->fds[f], 0, 0, file_size))
+         return -1;
+   }
+   return 0;
+}
+
 struct slab* create_slab(struct slab_context *ctx, int slab_worker_id, size_t item_size, struct slab_callback *callback) {
    struct stat sb;
    char path[512];
    struct slab *s = calloc(1, sizeof(*s));
 
-   size_t disk = slab_worker_id / (get_nb_workers()/get_nb_disks());
-   sprintf(path, PATH, disk, slab_worker_id, 0LU, item_size);
-   s->fd = open(path,  O_RDWR | O_CREAT | O_DIRECT, 0777);
-   if(s->fd == -1)
-      perr("Cannot allocate slab %s", path);
-
-   fstat(s->fd, &sb);
-   s->size_on_disk = sb.st_size;
-   if(s->size_on_disk < 2*PAGE_SIZE) {
-      fallocate(s->fd, 0, 0, 2*PAGE_SIZE);
-      s->size_on_disk = 2*PAGE_SIZE;
+   size_t disk = get_disk_of_worker(slab_worker_id);
+   size_t file_size = 0;
+   for(size_t f = 0; f < STRIPE_WIDTH; f++) { // stripes go to the next disks
+      sprintf(path, PATH, (disk + f) % get_nb_disks(), slab_worker_id, f, item_size);
+      if(IO_ENGINE == EMULATED)
+         s->fds[f] = emulated_open(path);
+      else
+         s->fds[f] = open(path,  O_RDWR | O_CREAT | O_DIRECT, 0777);
+      if(s->fds[f] == -1)
+         perr("Cannot allocate slab %s", path);
+
+      fstat(s->fds[f], &sb);
+      if(f == 0 || sb.st_size < file_size)
+         file_size = sb.st_size;
+   }
+   s->size_on_disk = file_size * STRIPE_WIDTH;
+   if(s->size_on_disk < 2*PAGE_SIZE*STRIPE_WIDTH) {
+      s->size_on_disk = 2*PAGE_SIZE*STRIPE_WIDTH;
+      if(allocate_slab(s, s->size_on_disk))
+         perr("Cannot allocate slab (item size %lu) size %lu\n", item_size, s->size_on_disk);
    }
 
    size_t nb_items_per_page = PAGE_SIZE / item_size;
@@ -132,36 +177,82 @@ struct slab* create_slab(struct slab_context *ctx, int slab_worker_id, size_t it
    s->nb_free_items = 0;
    s->last_item = 0;
    s->ctx = ctx;
+   s->sector_io = SECTOR_IO && item_size <= SECTOR_SIZE;
+   for(size_t f = 0; f < STRIPE_WIDTH; f++)
+      s->sector_io = s->sector_io && sector_io_supported(s->fds[f]);
+   if(SECTOR_IO && item_size <= SECTOR_SIZE && !s->sector_io)
+      printf("#WARNING! %s doesn't support %d bytes direct IOs, items of the slab will be read by pages\n", path, SECTOR_SIZE);
 
    // Read the first page and rebuild the index if the file contains data
    struct item_metadata *meta = read_item(s, 0);
    if(meta->key_size != 0) { // if the key_size is not 0 then then file has been written before
       callback->slab = s;
       rebuild_index(slab_worker_id, s, callback);
+      s->nb_initialized_pages = item_page_num(s, s->last_item - 1) + 1;
    }
+   s->extended_size = s->size_on_disk;
+   s->prealloc.last_item = s->last_item;
 
    return s;
 }
 
+/* Double the size of a slab, or grow it by 10GB when it is big already */
+static size_t next_slab_size(size_t size) {
+   if(size < 10000000000LU)
+      return size * 2;
+   else
+      return size + 10000000000LU;
+}
+
 /*
- * Double the size of a slab on disk
+ * Grow a slab on disk.
+ * With SLAB_PREALLOCATION the extender thread has usually allocated the space already and we just use it.
  */
 struct slab* resize_slab(struct slab *s) {
-   if(s->size_on_disk < 10000000000LU) {
-      s->size_on_disk *= 2;
-      if(fallocate(s->fd, 0, 0, s->size_on_disk))
-         perr("Cannot resize slab (item size %lu) new size %lu\n", s->item_size, s->size_on_disk);
-      s->nb_max_items *= 2;
-   } else {
-      size_t nb_items_per_page = PAGE_SIZE / s->item_size;
-      s->size_on_disk += 10000000000LU;
-      if(fallocate(s->fd, 0, 0, s->size_on_disk))
+   size_t nb_items_per_page = PAGE_SIZE / s->item_size;
+   size_t extended_size = __atomic_load_n(&s->extended_size, __ATOMIC_ACQUIRE);
+   if(SLAB_PREALLOCATION && extended_size > s->size_on_disk) {
+      s->size_on_disk = extended_size;
+   } else { // the extender is late, allocate synchronously
+      s->size_on_disk = next_slab_size(s->size_on_disk);
+      if(allocate_slab(s, s->size_on_disk))
          perr("Cannot resize slab (item size %lu) new size %lu\n", s->item_size, s->size_on_disk);
-      s->nb_max_items = s->size_on_disk / PAGE_SIZE * nb_items_per_page;
    }
+   s->nb_max_items = s->size_on_disk / PAGE_SIZE * nb_items_per_page;
    return s;
 }
 
+/*
+ * Called periodically by the extender thread (not by the worker of the slab!)
+ * Makes sure the file is big enough for the next SLAB_PREALLOCATION_AHEAD ms of inserts.
+ * The worker only reads extended_size, which is published once the space is allocated.
+ */
+void extend_slab_ahead(struct slab *s, uint64_t elapsed_us) {
+   size_t last_item = *(volatile size_t*)&s->last_item;
+   size_t nb_inserted = last_item - s->prealloc.last_item;
+   s->prealloc.last_item = last_item;
+   if(elapsed_us)
+      s->prealloc.insert_rate = (s->prealloc.insert_rate * 7 + nb_inserted * 1000000LU / elapsed_us) / 8;
+
+   size_t nb_items_per_page = PAGE_SIZE / s->item_size;
+   size_t nb_items_ahead = s->prealloc.insert_rate * SLAB_PREALLOCATION_AHEAD / 1000;
+   size_t wanted = ((last_item + nb_items_ahead) / nb_items_per_page + 1) * PAGE_SIZE;
+   size_t size = s->extended_size;
+   size_t size_on_disk = *(volatile size_t*)&s->size_on_disk; // the worker might have grown the file itself
+   if(size_on_disk > size)
+      size = size_on_disk;
+   if(wanted <= size)
+      return;
+
+   while(size < wanted)
+      size = next_slab_size(size);
+   if(allocate_slab(s, size)) {
+      printf("#WARNING! Cannot preallocate slab (item size %lu) new size %lu\n", s->item_size, size);
+      return;
+   }
+   __atomic_store_n(&s->extended_size, size, __ATOMIC_RELEASE);
+}
+
 
 
 
@@ -171,7 +262,7 @@ struct slab* resize_slab(struct slab *s) {
  */
 void *read_item(struct slab *s, size_t idx) {
    size_t page_num = item_page_num(s, idx);
-   char *disk_data = safe_pread(s->fd, page_num*PAGE_SIZE);
+   char *disk_data = safe_pread(slab_page_fd(s, page_num), slab_page_offset(s, page_num));
    return &disk_data[item_in_page_offset(s, idx)];
 }
 
@@ -184,13 +275,17 @@ void *read_item(struct slab *s, size_t idx) {
 void read_item_async_cb(struct slab_callback *callback) {
    char *disk_page = callback->lru_entry->page;
    off_t in_page_offset = item_in_page_offset(callback->slab, callback->slab_idx);
+   if(OBJECT_CACHE_SIZE)
+      objcache_admit(get_objcache(callback->slab->ctx), callback->slab, callback->slab_idx, &disk_page[in_page_offset]);
    if(callback->cb)
       callback->cb(callback, &disk_page[in_page_offset]);
 }
 
 void read_item_async(struct slab_callback *callback) {
+   size_t first_sector, nb_sectors;
+   item_sectors(callback->slab, callback->slab_idx, &first_sector, &nb_sectors);
    callback->io_cb = read_item_async_cb;
-   read_page_async(callback);
+   read_sectors_async(callback, first_sector, nb_sectors);
 }
 
 /*
@@ -198,7 +293,15 @@ void read_item_async(struct slab_callback *callback) {
  * - First read the page where the item is staying
  * - Once the page is in page cache, write it
  * - Then send the order to flush it.
+ * The whole page is read even with sector IOs: pages are always fully in memory when they are written (see ioengine.c).
+ *
+ * The read is skipped (blind write) when the page has never been written (appends) or when the item fills the page (4096B slab):
+ * in both cases we already know the content of the page. There is no old item to compare the new one to in the latter case.
  */
+static int item_fills_page(struct slab *s) {
+   return PAGE_SIZE / s->item_size == 1;
+}
+
 void update_item_async_cb2(struct slab_callback *callback) {
    char *disk_page = callback->lru_entry->page;
    off_t in_page_offset = item_in_page_offset(callback->slab, callback->slab_idx);
@@ -216,7 +319,7 @@ void update_item_async_cb1(struct slab_callback *callback) {
    off_t offset_in_page = item_in_page_offset(s, idx);
    struct item_metadata *old_meta = (void*)(&disk_page[offset_in_page]);
 
-   if(callback->action == UPDATE) {
+   if(callback->action == UPDATE && !item_fills_page(s)) {
       size_t new_key_size = meta->key_size;
       size_t old_key_size = old_meta->key_size;
       if(new_key_size != old_key_size) {
@@ -236,14 +339,27 @@ void update_item_async_cb1(struct slab_callback *callback) {
       die("Trying to write an item that is too big for its slab\n");
    else
       memcpy(&disk_page[offset_in_page], item, get_item_size(item));
+   if(OBJECT_CACHE_SIZE)
+      objcache_update(get_objcache(s->ctx), s, idx, &disk_page[offset_in_page]);
 
+   size_t first_sector, nb_sectors;
+   item_sectors(s, idx, &first_sector, &nb_sectors);
    callback->io_cb = update_item_async_cb2;
-   write_page_async(callback);
+   write_sectors_async(callback, first_sector, nb_sectors);
 }
 
 void update_item_async(struct slab_callback *callback) {
+   struct slab *s = callback->slab;
+   size_t page_num = item_page_num(s, callback->slab_idx);
+   int blind = (page_num >= s->nb_initialized_pages) || item_fills_page(s);
+   if(page_num >= s->nb_initialized_pages)
+      s->nb_initialized_pages = page_num + 1;
+
    callback->io_cb = update_item_async_cb1;
-   read_page_async(callback);
+   if(blind)
+      blank_page_async(callback);
+   else
+      read_page_async(callback);
 }
 
 /*
@@ -297,12 +413,16 @@ void remove_item_by_idx_async_cb1(struct slab_callback *callback) {
 
    meta->rdt = get_rdt(s->ctx);
    meta->key_size = -1;
+   if(OBJECT_CACHE_SIZE)
+      objcache_update(get_objcache(s->ctx), s, idx, meta);
 
    s->nb_items--;
    add_item_in_free_list(s, idx, meta);
 
+   size_t first_sector, nb_sectors;
+   item_sectors(s, idx, &first_sector, &nb_sectors);
    callback->io_cb = update_item_async_cb2;
-   write_page_async(callback);
+   write_sectors_async(callback, first_sector, nb_sectors);
 }
 
 
@@ -16,8 +16,15 @@ struct slab {
    size_t last_item;  // Total number of items, including freed
    size_t nb_max_items;
 
-   int fd;
-   size_t size_on_disk;
+   int fds[STRIPE_WIDTH]; // one file per stripe, see slab_page_fd
+   size_t size_on_disk; // all stripes together
+   size_t extended_size; // SLAB_PREALLOCATION: size allocated by the extender thread, adopted by the worker when it runs out of space
+   struct {
+      size_t last_item; // last_item during the previous check of the extender
+      size_t insert_rate; // items/s, moving average
+   } prealloc;
+   size_t nb_initialized_pages; // pages after that have never been written and only contain 0s
+   int sector_io; // items are read / written by sectors, see SECTOR_IO
 
    size_t nb_free_items, nb_free_items_in_memory;
    struct freelist_entry *freed_items, *freed_items_tail;
@@ -37,6 +44,7 @@ struct slab_callback {
 
    // Private
    enum slab_action action;
+   enum access_hint hint; // ACCESS_SCAN for the reads of scans (kv_read_async_no_lookup)
    struct slab *slab;
    union {
       uint64_t slab_idx;
@@ -48,6 +56,7 @@ struct slab_callback {
 
 struct slab* create_slab(struct slab_context *ctx, int worker_id, size_t item_size, struct slab_callback *callback);
 struct slab* resize_slab(struct slab *s);
+void extend_slab_ahead(struct slab *s, uint64_t elapsed_us);
 
 void *read_item(struct slab *s, size_t idx);
 void read_item_async(struct slab_callback *callback);
@@ -56,4 +65,6 @@ void update_item_async(struct slab_callback *callback);
 void remove_item_async(struct slab_callback *callback);
 
 off_t item_page_num(struct slab *s, size_t idx);
+int slab_page_fd(struct slab *s, size_t page_num);
+off_t slab_page_offset(struct slab *s, size_t page_num);
 #endif
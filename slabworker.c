@@ -12,11 +12,10 @@
  * for its slabs and processes answers for its slab only.
  *
  * We have the following files on disk:
- *  If we have W disk workers per disk
+ *  If slabs are striped over W files (STRIPE_WIDTH)
  *  If we have S slab workers
- *  And Y disks
- *  Then we have W * S * Y files for any given item size:.
- *  /scratchY/slab-a-w-x = slab worker a, disk worker w, item size x on disk Y
+ *  Then we have W * S files for any given item size:
+ *  /scratchY/slab-a-w-x = slab worker a, stripe w, item size x, on disk Y = (a + w) % nb_disks
  *
  * The slab.c functions abstract many disks into one, so
  *   /scratch** /slab-a-*-x  is the same virtual file
@@ -38,6 +37,11 @@ int get_nb_disks(void) {
    return nb_disks;
 }
 
+/* Workers are spread round robin over the disks, there can be any number of them */
+int get_disk_of_worker(int worker_id) {
+   return worker_id % nb_disks;
+}
+
 
 
 /*
@@ -53,8 +57,10 @@ struct slab_context {
    volatile size_t processed_callbacks;                  // Number of requests fully submitted and processed on disk
    size_t max_pending_callbacks;                         // Maximum number of enqueued requests
    struct pagecache *pagecache __attribute__((aligned(64)));
+   struct objcache *objcache;                            // OBJECT_CACHE_SIZE: hot items
    struct io_context *io_ctx;
    uint64_t rdt;                                         // Latest timestamp
+   volatile int flush_requested;                         // Write back: write all modified pages to disk, reset once done
 } *slab_contexts;
 
 /* A file is only managed by 1 worker. File => worker function. */
@@ -66,6 +72,10 @@ struct pagecache *get_pagecache(struct slab_context *ctx) {
    return ctx->pagecache;
 }
 
+struct objcache *get_objcache(struct slab_context *ctx) {
+   return ctx->objcache;
+}
+
 struct io_context *get_io_context(struct slab_context *ctx) {
    return ctx->io_ctx;
 }
@@ -141,9 +151,10 @@ struct slab *get_item_slab(int worker_id, void *item) {
    return get_slab(ctx, item);
 }
 
-static void enqueue_slab_callback(struct slab_context *ctx, enum slab_action action, struct slab_callback *callback) {
+static void enqueue_slab_callback(struct slab_context *ctx, enum slab_action action, enum access_hint hint, struct slab_callback *callback) {
    size_t buffer_idx = get_slab_buffer(ctx);
    callback->action = action;
+   callback->hint = hint;
    ctx->callbacks[buffer_idx] = callback;
    add_time_in_payload(callback, 0);
    submit_slab_buffer(ctx, buffer_idx);
@@ -166,34 +177,34 @@ void *kv_read_sync(void *item) {
 
 void kv_read_async(struct slab_callback *callback) {
    struct slab_context *ctx = get_slab_context(callback->item);
-   return enqueue_slab_callback(ctx, READ, callback);
+   return enqueue_slab_callback(ctx, READ, ACCESS_NORMAL, callback);
 }
 
 void kv_read_async_no_lookup(struct slab_callback *callback, struct slab *s, size_t slab_idx) {
    callback->slab = s;
    callback->slab_idx = slab_idx;
-   return enqueue_slab_callback(s->ctx, READ_NO_LOOKUP, callback);
+   return enqueue_slab_callback(s->ctx, READ_NO_LOOKUP, ACCESS_SCAN, callback);
 }
 
 void kv_add_async(struct slab_callback *callback) {
    struct slab_context *ctx = get_slab_context(callback->item);
-   enqueue_slab_callback(ctx, ADD, callback);
+   enqueue_slab_callback(ctx, ADD, ACCESS_NORMAL, callback);
 }
 
 void kv_update_async(struct slab_callback *callback) {
    struct slab_context *ctx = get_slab_context(callback->item);
-   return enqueue_slab_callback(ctx, UPDATE, callback);
+   return enqueue_slab_callback(ctx, UPDATE, ACCESS_NORMAL, callback);
 }
 
 void kv_add_or_update_async(struct slab_callback *callback) {
    struct slab_context *ctx = get_slab_context(callback->item);
-   return enqueue_slab_callback(ctx, ADD_OR_UPDATE, callback);
+   return enqueue_slab_callback(ctx, ADD_OR_UPDATE, ACCESS_NORMAL, callback);
 }
 
 
 void kv_remove_async(struct slab_callback *callback) {
    struct slab_context *ctx = get_slab_context(callback->item);
-   return enqueue_slab_callback(ctx, DELETE, callback);
+   return enqueue_slab_callback(ctx, DELETE, ACCESS_NORMAL, callback);
 }
 
 tree_scan_res_t kv_init_scan(void *item, size_t scan_size) {
@@ -204,6 +215,17 @@ tree_scan_res_t kv_init_scan(void *item, size_t scan_size) {
  * Worker context
  */
 
+/* Read an item whose location is known, from the object cache if it is there */
+static void worker_read_item(struct slab_context *ctx, struct slab_callback *callback) {
+   void *item;
+   if(OBJECT_CACHE_SIZE && (item = objcache_lookup(ctx->objcache, callback->slab, callback->slab_idx))) {
+      if(callback->cb)
+         callback->cb(callback, item);
+   } else {
+      read_item_async(callback);
+   }
+}
+
 /* Dequeue enqueued callbacks */
 static void worker_dequeue_requests(struct slab_context *ctx) {
    size_t retries =  0;
@@ -223,7 +245,7 @@ again:
 
       switch(action) {
          case READ_NO_LOOKUP:
-            read_item_async(callback);
+            worker_read_item(ctx, callback);
             break;
          case READ:
             if(!e) { // Item is not in DB
@@ -233,7 +255,7 @@ again:
             } else {
                callback->slab = e->slab;
                callback->slab_idx = e->slab_idx;
-               read_item_async(callback);
+               worker_read_item(ctx, callback);
             }
             break;
          case ADD:
@@ -286,12 +308,12 @@ again:
             die("Unknown action\n");
       }
       ctx->processed_callbacks++;
-      if(NEVER_EXCEED_QUEUE_DEPTH && io_pending(ctx->io_ctx) >= QUEUE_DEPTH)
+      if(NEVER_EXCEED_QUEUE_DEPTH && io_pending(ctx->io_ctx) >= io_queue_depth(ctx->io_ctx))
          break;
    }
 
    if(WAIT_A_BIT_FOR_MORE_IOS) {
-      while(retries < 5 && io_pending(ctx->io_ctx) < QUEUE_DEPTH) {
+      while(retries < 5 && io_pending(ctx->io_ctx) < io_queue_depth(ctx->io_ctx)) {
          retries++;
          pending = ctx->sent_callbacks - ctx->processed_callbacks;
          if(pending == 0) {
@@ -303,6 +325,20 @@ again:
    }
 }
 
+/*
+ * Write back: let the flusher send modified pages to disk.
+ * When a flush has been requested, the request is acknowledged once all modified pages have been written (and the IO trace saved).
+ */
+static void worker_flush_pages(struct slab_context *ctx) {
+   if(!WRITE_BACK && !IO_TRACE)
+      return;
+   worker_ioengine_flush(ctx->io_ctx, ctx->pagecache, ctx->flush_requested);
+   if(ctx->flush_requested && !ctx->pagecache->nb_modified_pages && !io_pending(ctx->io_ctx)) {
+      worker_ioengine_trace_flush(ctx->io_ctx);
+      ctx->flush_requested = 0;
+   }
+}
+
 static void worker_slab_init_cb(struct slab_callback *cb, void *item) {
    struct item_metadata *new_meta = item;
    if(!memory_index_lookup(get_worker(cb->slab), item)) {
@@ -334,9 +370,12 @@ static void *worker_slab_init(void *pdata) {
    /* Create the pagecache for the worker */
    ctx->pagecache = calloc(1, sizeof(*ctx->pagecache));
    page_cache_init(ctx->pagecache);
+   if(OBJECT_CACHE_SIZE)
+      ctx->objcache = objcache_init(OBJECT_CACHE_SIZE / nb_workers);
 
    /* Initialize the async io for the worker */
-   ctx->io_ctx = worker_ioengine_init(ctx->max_pending_callbacks);
+   ctx->io_ctx = worker_ioengine_init(ctx->worker_id, ctx->max_pending_callbacks);
+   worker_ioengine_register_pagecache(ctx->io_ctx, ctx->pagecache);
 
    /* Rebuild existing data structures */
    size_t nb_slabs = sizeof(slab_sizes)/sizeof(*slab_sizes);
@@ -347,6 +386,9 @@ static void *worker_slab_init(void *pdata) {
       ctx->slabs[i] = create_slab(ctx, ctx->worker_id, slab_sizes[i], cb);
    }
    free(cb);
+   worker_ioengine_register_slabs(ctx->io_ctx, ctx->slabs, nb_slabs);
+   if(WARMUP)
+      warmup_load(ctx->worker_id, ctx->pagecache, ctx->slabs, nb_slabs);
 
     __sync_add_and_fetch(&nb_workers_ready, 1);
 
@@ -355,14 +397,26 @@ static void *worker_slab_init(void *pdata) {
    while(1) {
       ctx->rdt++;
 
-      while(io_pending(ctx->io_ctx)) {
-         worker_ioengine_enqueue_ios(ctx->io_ctx); __1
-         worker_ioengine_get_completed_ios(ctx->io_ctx); __2
-         worker_ioengine_process_completed_ios(ctx->io_ctx); __3
-      }
-
+      /*
+       * IOs are pipelined: we submit new IOs and reap the IOs that have completed, but we only block waiting for the disk
+       * when there is nothing else to do (no new request, or the queue depth is already reached).
+       */
       volatile size_t pending = ctx->sent_callbacks - ctx->processed_callbacks;
+      int can_dequeue = pending && (!NEVER_EXCEED_QUEUE_DEPTH || io_pending(ctx->io_ctx) < io_queue_depth(ctx->io_ctx));
+      worker_flush_pages(ctx);
+      if(PAGECACHE_RELEASES_FRAMES)
+         page_cache_release_frames(ctx->pagecache);
+      worker_ioengine_enqueue_ios(ctx->io_ctx); __1
+      worker_ioengine_get_completed_ios(ctx->io_ctx, !can_dequeue); __2
+      worker_ioengine_process_completed_ios(ctx->io_ctx); __3
+
+      pending = ctx->sent_callbacks - ctx->processed_callbacks;
       while(!pending && !io_pending(ctx->io_ctx)) {
+         worker_flush_pages(ctx); // modified pages still have to reach the disk when the worker is idle
+         if(PAGECACHE_RELEASES_FRAMES) // idle workers are the first to give their frames
+            page_cache_release_frames(ctx->pagecache);
+         if(io_pending(ctx->io_ctx))
+            break;
          if(!PINNING) {
             usleep(2);
          } else {
@@ -379,10 +433,90 @@ static void *worker_slab_init(void *pdata) {
    return NULL;
 }
 
-void slab_workers_init(int _nb_disks, int nb_workers_per_disk) {
+/*
+ * Slab extender: grows slab files ahead of the inserts, so that workers don't stall in fallocate (see resize_slab).
+ */
+static void *slab_extender(void *pdata) {
+   size_t nb_slabs = sizeof(slab_sizes)/sizeof(*slab_sizes);
+   uint64_t last, now;
+   rdtscll(last);
+   while(1) {
+      usleep(SLAB_PREALLOCATION_PERIOD * 1000);
+      rdtscll(now);
+      uint64_t elapsed = cycles_to_us(now - last);
+      last = now;
+      for(size_t w = 0; w < nb_workers; w++) {
+         for(size_t i = 0; i < nb_slabs; i++)
+            extend_slab_ahead(slab_contexts[w].slabs[i], elapsed);
+      }
+   }
+   return NULL;
+}
+
+/*
+ * Page cache governor: moves page frames between the page caches of the workers (see page_cache_rebalance).
+ */
+static void *page_cache_governor(void *pdata) {
+   struct pagecache **caches = malloc(nb_workers * sizeof(*caches));
+   for(size_t w = 0; w < nb_workers; w++)
+      caches[w] = slab_contexts[w].pagecache;
+   while(1) {
+      usleep(GOVERNOR_PERIOD * 1000);
+      page_cache_rebalance(caches, nb_workers);
+   }
+   return NULL;
+}
+
+/*
+ * Page cache resizer: shrinks the page caches of the workers when memory is under pressure, grows them back when it isn't (see page_cache_resize).
+ */
+static void *page_cache_resizer(void *pdata) {
+   struct pagecache **caches = malloc(nb_workers * sizeof(*caches));
+   struct mempressure m;
+   size_t size = 0;
+   for(size_t w = 0; w < nb_workers; w++) {
+      caches[w] = slab_contexts[w].pagecache;
+      size += caches[w]->target_pages;
+   }
+   mempressure_init(&m);
+   while(1) {
+      usleep(RESIZE_PERIOD * 1000);
+      int pressure = mempressure_check(&m, PAGE_CACHE_SIZE * RESIZE_STEP / 100);
+      if(!pressure)
+         continue;
+      size_t new_size = page_cache_resize(caches, nb_workers, pressure > 0);
+      if(new_size != size)
+         printf("#Page cache %s to %lu MB (memory pressure)\n", (new_size > size)?"grown":"shrunk", new_size*PAGE_SIZE/1024/1024);
+      size = new_size;
+   }
+   return NULL;
+}
+
+/*
+ * Warm-up: saves the pages cached by the workers every WARMUP_PERIOD seconds, see warmup.c.
+ * The saver and the shutdown can save at the same time, and both would write the same temporary file: saves are serialized.
+ */
+static pthread_mutex_t warmup_save_lock = PTHREAD_MUTEX_INITIALIZER;
+static void warmup_save_all(void) {
+   size_t nb_slabs = sizeof(slab_sizes)/sizeof(*slab_sizes);
+   pthread_mutex_lock(&warmup_save_lock);
+   for(size_t w = 0; w < nb_workers; w++)
+      warmup_save(w, slab_contexts[w].pagecache, slab_contexts[w].slabs, nb_slabs);
+   pthread_mutex_unlock(&warmup_save_lock);
+}
+
+static void *warmup_saver(void *pdata) {
+   while(1) {
+      sleep(WARMUP_PERIOD);
+      warmup_save_all();
+   }
+   return NULL;
+}
+
+void slab_workers_init(int _nb_disks, int _nb_workers) {
    size_t max_pending_callbacks = MAX_NB_PENDING_CALLBACKS_PER_WORKER;
    nb_disks = _nb_disks;
-   nb_workers = nb_disks * nb_workers_per_disk;
+   nb_workers = _nb_workers;
 
    memory_index_init();
 
@@ -399,6 +533,37 @@ void slab_workers_init(int _nb_disks, int nb_workers_per_disk) {
    while(*(volatile int*)&nb_workers_ready != nb_workers) {
       NOP10();
    }
+
+   if(SLAB_PREALLOCATION)
+      pthread_create(&t, NULL, slab_extender, NULL);
+   if(PAGECACHE_GOVERNOR)
+      pthread_create(&t, NULL, page_cache_governor, NULL);
+   if(PAGECACHE_RESIZE)
+      pthread_create(&t, NULL, page_cache_resizer, NULL);
+   if(WARMUP)
+      pthread_create(&t, NULL, warmup_saver, NULL);
+}
+
+/*
+ * Write back: make sure everything that has been acknowledged is on disk before exiting.
+ * IO_TRACE: make sure the end of the traces is written.
+ * WARMUP: save the pages cached for the next start.
+ */
+void slab_workers_shutdown(void) {
+   if(WARMUP)
+      warmup_save_all();
+   if(!WRITE_BACK && !IO_TRACE)
+      return;
+
+   declare_timer;
+   start_timer {
+      for(size_t w = 0; w < nb_workers; w++)
+         slab_contexts[w].flush_requested = 1;
+      for(size_t w = 0; w < nb_workers; w++) {
+         while(slab_contexts[w].flush_requested)
+            NOP10();
+      }
+   } stop_timer("Flushing modified pages and traces");
 }
 
 size_t get_database_size(void) {
@@ -19,15 +19,18 @@ void kv_read_async_no_lookup(struct slab_callback *callback, struct slab *s, siz
 size_t get_database_size(void);
 
 
-void slab_workers_init(int nb_disks, int nb_workers_per_disk);
+void slab_workers_init(int nb_disks, int nb_workers);
+void slab_workers_shutdown(void);
 int get_nb_workers(void);
 void *kv_read_sync(void *item); // Unsafe
 struct pagecache *get_pagecache(struct slab_context *ctx);
+struct objcache *get_objcache(struct slab_context *ctx);
 struct io_context *get_io_context(struct slab_context *ctx);
 uint64_t get_rdt(struct slab_context *ctx);
 void set_rdt(struct slab_context *ctx, uint64_t val);
 int get_worker(struct slab *s);
 int get_nb_disks(void);
+int get_disk_of_worker(int worker_id);
 struct slab *get_item_slab(int worker_id, void *item);
 size_t get_item_size(char *item);
 #endif
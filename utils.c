@@ -35,6 +35,10 @@ uint64_t cycles_to_us(uint64_t cycles) {
    return cycles*1000000LU/get_cpu_freq();
 }
 
+uint64_t us_to_cycles(uint64_t us) {
+   return us*get_cpu_freq()/1000000LU;
+}
+
 void shuffle(size_t *array, size_t n) {
    if (n > 1) {
       size_t i;
@@ -247,5 +247,6 @@
  * Helper functions
  */
 uint64_t cycles_to_us(uint64_t cycles);
+uint64_t us_to_cycles(uint64_t us);
 void shuffle(size_t *array, size_t n);
 void pin_me_on(int core);
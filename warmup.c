@@ -0,0 +1,205 @@
+#include "headers.h"
+
+/*
+ * Page cache warm-up (WARMUP).
+ *
+ * After a restart the page caches are empty and the hot pages come back one random read at a time, so KVell runs cold for minutes.
+ * The pages cached by every worker are saved periodically (warmup_save, called by a background thread, see slabworker.c), and a worker
+ * reads them back before it starts serving requests (warmup_load).
+ *
+ * File descriptors change between runs, so the file lists the pages as slab page numbers, per slab (identified by its item size).
+ * The page numbers of a slab are sorted and delta encoded in LEB128 varints: hot pages are dense, most deltas fit in a byte.
+ * File:  [struct warmup_header] then for each slab [struct warmup_slab][nb_bytes of varints]
+ * The file is written next to the final one and renamed, a crash while saving keeps the previous list.
+ *
+ * The pages are read back file by file in increasing offsets: pages that are less than WARMUP_MAX_GAP pages apart are read together,
+ * by IOs of up to WARMUP_MAX_IO pages. At most the size of the page cache is read.
+ */
+#define WARMUP_MAGIC 0x4b5657524d555031LU
+
+struct warmup_header {
+   uint64_t magic;
+   uint32_t worker_id;
+   uint32_t nb_slabs;
+};
+
+struct warmup_slab {
+   uint64_t item_size;
+   uint64_t nb_pages;
+   uint64_t nb_bytes;
+};
+
+static void get_warmup_path(char *path, int worker_id) {
+   size_t disk = get_disk_of_worker(worker_id);
+   sprintf(path, WARMUP_PATH, disk, worker_id);
+}
+
+static size_t put_varint(uint8_t *buf, uint64_t v) {
+   size_t n = 0;
+   while(v >= 128) {
+      buf[n++] = v | 128;
+      v >>= 7;
+   }
+   buf[n++] = v;
+   return n;
+}
+
+static uint64_t get_varint(const uint8_t *buf, size_t *pos, size_t size) {
+   uint64_t v = 0;
+   for(size_t shift = 0; *pos < size && shift < 64; shift += 7) {
+      uint8_t b = buf[(*pos)++];
+      v |= (uint64_t)(b & 127) << shift;
+      if(!(b & 128))
+         break;
+   }
+   return v;
+}
+
+static int cmp_u64(const void *_a, const void *_b) {
+   uint64_t a = *(uint64_t*)_a, b = *(uint64_t*)_b;
+   return (a < b)?-1:(a > b);
+}
+
+/* Slab page of a page cache hash (see get_hash_for_page and slab_page_fd). @return 0 if the page isn't a page of the slab */
+static int slab_page_of_hash(struct slab *s, uint64_t hash, uint64_t *page_num) {
+   int fd = hash >> 40;
+   for(size_t f = 0; f < STRIPE_WIDTH; f++) {
+      if(s->fds[f] == fd) {
+         *page_num = (hash & ((1LU << 40) - 1)) * STRIPE_WIDTH + f;
+         return 1;
+      }
+   }
+   return 0;
+}
+
+void warmup_save(int worker_id, struct pagecache *p, struct slab **slabs, size_t nb_slabs) {
+   char path[512], tmp_path[512 + 4];
+   uint64_t *hashes = malloc(p->max_pages * sizeof(*hashes));
+   uint64_t *pages = malloc(p->max_pages * sizeof(*pages));
+   uint8_t *varints = malloc(p->max_pages * 10);
+   size_t nb_hashes = page_cache_cached_pages(p, hashes, p->max_pages);
+
+   get_warmup_path(path, worker_id);
+   sprintf(tmp_path, "%s.tmp", path);
+   FILE *f = fopen(tmp_path, "w");
+   if(!f) {
+      printf("#WARNING! Cannot save the pages of the page cache in %s (%s)\n", tmp_path, strerror(errno));
+      goto end;
+   }
+   struct warmup_header header = { .magic = WARMUP_MAGIC, .worker_id = worker_id, .nb_slabs = nb_slabs };
+   fwrite(&header, sizeof(header), 1, f);
+   for(size_t i = 0; i < nb_slabs; i++) {
+      struct slab *s = slabs[i];
+      size_t nb_pages = 0, nb_bytes = 0;
+      for(size_t j = 0; j < nb_hashes; j++) {
+         if(slab_page_of_hash(s, hashes[j], &pages[nb_pages]))
+            nb_pages++;
+      }
+      qsort(pages, nb_pages, sizeof(*pages), cmp_u64);
+      for(size_t j = 0; j < nb_pages; j++)
+         nb_bytes += put_varint(&varints[nb_bytes], j?(pages[j] - pages[j - 1]):pages[j]);
+
+      struct warmup_slab slab_header = { .item_size = s->item_size, .nb_pages = nb_pages, .nb_bytes = nb_bytes };
+      fwrite(&slab_header, sizeof(slab_header), 1, f);
+      fwrite(varints, 1, nb_bytes, f);
+   }
+   if(fflush(f) || fsync(fileno(f)) || fclose(f) || rename(tmp_path, path))
+      printf("#WARNING! Cannot save the pages of the page cache in %s (%s)\n", path, strerror(errno));
+
+end:
+   free(hashes);
+   free(pages);
+   free(varints);
+}
+
+/* Read pages [first, last] of a file of the slab and put the wanted ones in the page cache. @return the number of pages cached */
+static size_t warmup_read(struct pagecache *p, struct slab *s, size_t file, uint64_t *wanted, size_t nb_wanted, char *buffer) {
+   uint64_t first = wanted[0], last = wanted[nb_wanted - 1];
+   int fd = s->fds[file];
+   ssize_t r = pread(fd, buffer, (last - first + 1) * PAGE_SIZE, first * PAGE_SIZE);
+   if(r < 0)
+      return 0;
+
+   size_t nb_cached = 0;
+   for(size_t i = 0; i < nb_wanted; i++) {
+      void *page;
+      struct lru *lru;
+      if((wanted[i] - first + 1) * PAGE_SIZE > r) // short read, end of the file
+         break;
+      if(!get_page(p, get_hash_for_page(fd, wanted[i]), ACCESS_NORMAL, &page, &lru))
+         memcpy(page, &buffer[(wanted[i] - first) * PAGE_SIZE], PAGE_SIZE);
+      lru->contains_data = 1;
+      lru->valid_sectors = ALL_SECTORS;
+      nb_cached++;
+   }
+   return nb_cached;
+}
+
+void warmup_load(int worker_id, struct pagecache *p, struct slab **slabs, size_t nb_slabs) {
+   char path[512];
+   struct warmup_header header;
+   size_t nb_cached = 0, nb_ios = 0, max_pages = p->target_pages;
+
+   get_warmup_path(path, worker_id);
+   FILE *f = fopen(path, "r");
+   if(!f)
+      return;
+   if(fread(&header, sizeof(header), 1, f) != 1 || header.magic != WARMUP_MAGIC || header.worker_id != worker_id || header.nb_slabs != nb_slabs) {
+      printf("#WARNING! %s is not the page list of worker %d, ignored\n", path, worker_id);
+      fclose(f);
+      return;
+   }
+
+   char *buffer = aligned_alloc(PAGE_SIZE, WARMUP_MAX_IO * PAGE_SIZE); // slabs are opened with O_DIRECT
+   declare_timer;
+   start_timer {
+      for(size_t i = 0; i < nb_slabs && nb_cached < max_pages; i++) {
+         struct warmup_slab slab_header;
+         if(fread(&slab_header, sizeof(slab_header), 1, f) != 1)
+            break;
+         uint8_t *varints = malloc(slab_header.nb_bytes);
+         uint64_t *pages = malloc(slab_header.nb_pages * sizeof(*pages));
+         if(fread(varints, 1, slab_header.nb_bytes, f) != slab_header.nb_bytes) {
+            free(varints);
+            free(pages);
+            break;
+         }
+
+         struct slab *s = NULL;
+         for(size_t j = 0; j < nb_slabs; j++)
+            if(slabs[j]->item_size == slab_header.item_size)
+               s = slabs[j];
+         size_t pos = 0;
+         uint64_t page_num = 0;
+         for(size_t j = 0; j < slab_header.nb_pages; j++) {
+            page_num += get_varint(varints, &pos, slab_header.nb_bytes);
+            pages[j] = page_num;
+         }
+
+         // File by file, by increasing offsets; pages past the end of the slab (it has been wiped) are ignored
+         size_t nb_pages_in_file = s?(s->size_on_disk / STRIPE_WIDTH / PAGE_SIZE):0;
+         for(size_t file = 0; file < STRIPE_WIDTH && nb_cached < max_pages; file++) {
+            uint64_t wanted[WARMUP_MAX_IO];
+            size_t nb_wanted = 0;
+            for(size_t j = 0; j <= slab_header.nb_pages && nb_cached < max_pages; j++) {
+               int end = (j == slab_header.nb_pages);
+               uint64_t page_in_file = end?0:(pages[j] / STRIPE_WIDTH);
+               if(!end && (pages[j] % STRIPE_WIDTH != file || page_in_file >= nb_pages_in_file))
+                  continue;
+               if(nb_wanted && (end || page_in_file - wanted[nb_wanted - 1] > WARMUP_MAX_GAP || page_in_file - wanted[0] >= WARMUP_MAX_IO
+                        || nb_cached + nb_wanted >= max_pages)) {
+                  nb_cached += warmup_read(p, s, file, wanted, nb_wanted, buffer);
+                  nb_ios++;
+                  nb_wanted = 0;
+               }
+               if(!end)
+                  wanted[nb_wanted++] = page_in_file;
+            }
+         }
+         free(varints);
+         free(pages);
+      }
+   } stop_timer("[SLAB WORKER %d] Warm-up: %lu pages read in the page cache with %lu IOs", worker_id, nb_cached, nb_ios);
+   free(buffer);
+   fclose(f);
+}
@@ -0,0 +1,7 @@
+#ifndef WARMUP_H
+#define WARMUP_H 1
+
+void warmup_save(int worker_id, struct pagecache *p, struct slab **slabs, size_t nb_slabs);
+void warmup_load(int worker_id, struct pagecache *p, struct slab **slabs, size_t nb_slabs);
+
+#endif
@@ -0,0 +1,258 @@
+#include "headers.h"
+
+/*
+ * Compressed tier of the page cache.
+ *
+ * When the page cache evicts a page whose content is valid, the page is compressed and kept here instead of being lost.
+ * A miss of the page cache looks in the tier before the IO engine reads the page from disk: if the page is there, it is
+ * decompressed in the frame of the new page and removed from the tier (a page is either in the page cache or in the tier,
+ * so the copy in the tier is never stale: pages are only modified in the page cache).
+ * Slab pages contain a lot of padding and zeroes (see the 1365B slab of YCSB items), so the tier holds 2-3x more pages than
+ * the same memory in the page cache. Pages that don't compress to ZCACHE_MAX_RATIO % of a page are not kept.
+ *
+ * Compressed pages are appended in a log and evicted in FIFO order from its head, i.e., in the order the page cache evicted them.
+ * A page taken back by the page cache leaves a hole that is reclaimed when the head reaches it.
+ *
+ * Compression is a byte oriented LZ77 (the format of LZ4 blocks, without the end of block restrictions): a page compresses
+ * in a few us and decompresses in less than 1us, much faster than a read from the drive.
+ */
+#define ZCACHE_MAX_RATIO 75
+#define ZCACHE_MIN_RECORD 64 // the index is sized for size / ZCACHE_MIN_RECORD pages
+
+struct zpage {
+   uint64_t hash;
+   uint32_t size;       // bytes used in the log, header included
+   uint16_t csize;      // size of the compressed page
+   uint8_t valid;       // 0 once the page has been taken back by the page cache
+   // compressed page
+};
+
+/*
+ * LZ compression.
+ * A sequence is a token (4 bits of literal length, 4 bits of match length - LZ_MIN_MATCH, 15 = more length bytes follow),
+ * the literals, and the 2 bytes offset of the match; the last sequence only has literals.
+ */
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 12
+
+static uint32_t lz_load32(const uint8_t *p) {
+   uint32_t v;
+   memcpy(&v, p, sizeof(v));
+   return v;
+}
+
+static uint64_t lz_load64(const uint8_t *p) {
+   uint64_t v;
+   memcpy(&v, p, sizeof(v));
+   return v;
+}
+
+static uint32_t lz_hash(uint32_t v) {
+   return (v * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+static int lz_put_length(uint8_t *dst, size_t cap, size_t *op, size_t len) {
+   while(len >= 255) {
+      if(*op >= cap)
+         return 0;
+      dst[(*op)++] = 255;
+      len -= 255;
+   }
+   if(*op >= cap)
+      return 0;
+   dst[(*op)++] = len;
+   return 1;
+}
+
+/* One sequence; match_len == 0 for the last one. @return 0 if it doesn't fit in cap */
+static int lz_put_sequence(uint8_t *dst, size_t cap, size_t *op, const uint8_t *literals, size_t nb_literals, size_t offset, size_t match_len) {
+   size_t ml = match_len?match_len - LZ_MIN_MATCH:0;
+   if(*op >= cap)
+      return 0;
+   dst[(*op)++] = ((nb_literals < 15)?nb_literals:15) << 4 | ((ml < 15)?ml:15);
+   if(nb_literals >= 15 && !lz_put_length(dst, cap, op, nb_literals - 15))
+      return 0;
+   if(*op + nb_literals > cap)
+      return 0;
+   memcpy(&dst[*op], literals, nb_literals);
+   *op += nb_literals;
+   if(!match_len)
+      return 1;
+   if(*op + 2 > cap)
+      return 0;
+   dst[(*op)++] = offset;
+   dst[(*op)++] = offset >> 8;
+   if(ml >= 15 && !lz_put_length(dst, cap, op, ml - 15))
+      return 0;
+   return 1;
+}
+
+/* @return the compressed size, 0 if it is bigger than cap */
+static size_t lz_compress(const uint8_t *src, size_t n, uint8_t *dst, size_t cap) {
+   uint16_t table[1 << LZ_HASH_BITS];
+   size_t ip = 1, anchor = 0, op = 0;
+   memset(table, 0, sizeof(table));
+   while(ip + LZ_MIN_MATCH <= n) {
+      uint32_t seq = lz_load32(&src[ip]);
+      uint32_t h = lz_hash(seq);
+      size_t candidate = table[h];
+      table[h] = ip;
+      if(lz_load32(&src[candidate]) != seq) {
+         ip += 1 + ((ip - anchor) >> 6); // skip faster in incompressible data
+         continue;
+      }
+      size_t len = LZ_MIN_MATCH;
+      while(ip + len + 8 <= n) { // 8 bytes at a time, the first different byte is the first non zero byte of the xor (little endian)
+         uint64_t diff = lz_load64(&src[candidate + len]) ^ lz_load64(&src[ip + len]);
+         if(diff) {
+            len += __builtin_ctzll(diff) / 8;
+            goto match_found;
+         }
+         len += 8;
+      }
+      while(ip + len < n && src[candidate + len] == src[ip + len])
+         len++;
+match_found:
+      if(!lz_put_sequence(dst, cap, &op, &src[anchor], ip - anchor, ip - candidate, len))
+         return 0;
+      ip += len;
+      anchor = ip;
+   }
+   if(!lz_put_sequence(dst, cap, &op, &src[anchor], n - anchor, 0, 0))
+      return 0;
+   return op;
+}
+
+static size_t lz_get_length(const uint8_t *src, size_t *ip, size_t len) {
+   if(len < 15)
+      return len;
+   uint8_t b;
+   do {
+      b = src[(*ip)++];
+      len += b;
+   } while(b == 255);
+   return len;
+}
+
+/* @return the decompressed size */
+static size_t lz_decompress(const uint8_t *src, size_t csize, uint8_t *dst, size_t cap) {
+   size_t ip = 0, op = 0;
+   while(ip < csize) {
+      uint8_t token = src[ip++];
+      size_t nb_literals = lz_get_length(src, &ip, token >> 4);
+      if(op + nb_literals > cap || ip + nb_literals > csize)
+         return 0;
+      memcpy(&dst[op], &src[ip], nb_literals);
+      ip += nb_literals;
+      op += nb_literals;
+      if(ip >= csize) // last sequence
+         break;
+      size_t offset = src[ip] | (src[ip + 1] << 8);
+      ip += 2;
+      size_t match_len = lz_get_length(src, &ip, token & 15) + LZ_MIN_MATCH;
+      if(offset == 0 || offset > op || op + match_len > cap)
+         return 0;
+      if(offset == 1) { // run of the same byte (zeroes)
+         memset(&dst[op], dst[op - 1], match_len);
+         op += match_len;
+         continue;
+      }
+      // The match may overlap the bytes it produces. The bytes from start repeat with a period of offset, and op - start
+      // stays a multiple of offset, so the copied chunk can double every time without overlapping.
+      size_t start = op - offset;
+      while(match_len) {
+         size_t len = (match_len < op - start)?match_len:(op - start);
+         memcpy(&dst[op], &dst[start], len);
+         op += len;
+         match_len -= len;
+      }
+   }
+   return op;
+}
+
+/*
+ * The tier
+ */
+struct zcache *zcache_init(size_t size) {
+   struct zcache *z = calloc(1, sizeof(*z));
+   z->size = size;
+   z->log = malloc(size);
+   if(!z->log)
+      die("Cannot allocate %lu bytes for the compressed page cache -- see options.h\n", size);
+   z->index = hashtable_create(size / ZCACHE_MIN_RECORD);
+   return z;
+}
+
+static void evict_head(struct zcache *z) {
+   struct zpage *zp = (struct zpage *)&z->log[z->head];
+   if(zp->valid) {
+      hashtable_delete(z->index, zp->hash);
+      z->nb_evicted++;
+   }
+   z->head += zp->size;
+   if(z->head == z->data_end) {
+      z->head = 0;
+      z->wrapped = 0;
+   }
+}
+
+/* @return the offset of size free contiguous bytes at the tail of the log */
+static size_t make_room(struct zcache *z, size_t size) {
+   while(1) {
+      if(!z->wrapped) {
+         if(z->size - z->tail >= size)
+            return z->tail;
+         z->data_end = z->tail;
+         z->tail = 0;
+         z->wrapped = 1;
+         if(z->head == z->data_end) { // empty log
+            z->head = 0;
+            z->wrapped = 0;
+         }
+      } else {
+         if(z->head - z->tail >= size)
+            return z->tail;
+         evict_head(z);
+      }
+   }
+}
+
+void zcache_put(struct zcache *z, uint64_t hash, void *page) {
+   uint8_t compressed[PAGE_SIZE * ZCACHE_MAX_RATIO / 100];
+   size_t csize = lz_compress(page, PAGE_SIZE, compressed, sizeof(compressed));
+   if(!csize) {
+      z->nb_incompressible++;
+      return;
+   }
+
+   size_t size = (sizeof(struct zpage) + csize + 7) / 8 * 8;
+   if(size < ZCACHE_MIN_RECORD)
+      size = ZCACHE_MIN_RECORD;
+   if(size > z->size / 16)
+      return;
+   struct zpage *zp = (struct zpage *)&z->log[make_room(z, size)];
+   zp->hash = hash;
+   zp->size = size;
+   zp->csize = csize;
+   zp->valid = 1;
+   memcpy(&zp[1], compressed, csize);
+
+   struct index_entry e = { .slab = NULL, .slab_idx = z->tail };
+   hashtable_insert(z->index, hash, &e);
+   z->tail += size;
+   z->nb_stored++;
+   z->stored_bytes += csize;
+}
+
+int zcache_get(struct zcache *z, uint64_t hash, void *page) {
+   struct index_entry *e = hashtable_lookup(z->index, hash);
+   if(!e)
+      return 0;
+   struct zpage *zp = (struct zpage *)&z->log[e->slab_idx];
+   if(lz_decompress((uint8_t *)&zp[1], zp->csize, page, PAGE_SIZE) != PAGE_SIZE)
+      die("Corrupted page in the compressed page cache (hash %lu)\n", hash);
+   hashtable_delete(z->index, hash);
+   zp->valid = 0;
+   z->nb_hits++;
+   return 1;
+}
@@ -0,0 +1,25 @@
+#ifndef ZCACHE_H
+#define ZCACHE_H 1
+
+#include "indexes/hashtable.h"
+
+/*
+ * Compressed tier of the page cache of a worker (see zcache.c), only used by the worker that owns the page cache.
+ */
+struct zcache {
+   char *log;                 // compressed pages, appended at the tail and evicted at the head
+   size_t size;
+   size_t head, tail;
+   size_t data_end;           // when the log has wrapped: end of the pages that are before the tail
+   int wrapped;               // the tail is before the head, pages are in [head, data_end) and [0, tail)
+   hashtable_t *index;        // hash of the page -> offset of the compressed page in the log
+
+   size_t nb_stored, nb_incompressible, nb_hits, nb_evicted;
+   size_t stored_bytes;       // compressed size of the pages stored since the beginning
+};
+
+struct zcache *zcache_init(size_t size);
+void zcache_put(struct zcache *z, uint64_t hash, void *page); // the page is not in the page cache anymore, its content is valid
+int zcache_get(struct zcache *z, uint64_t hash, void *page); // @return 1 if the page was in the tier, it is then decompressed in page and removed from the tier
+
+#endif